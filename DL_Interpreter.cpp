@@ -1,730 +1,3276 @@
 #include <iostream>
 #include <string>
 #include <vector>
-#include <stack>
+#include <memory>
 #include <unordered_map>
 #include <algorithm>
+#include <chrono>
 #include <fstream>
 #include <sstream>
+#include <string_view>
+#include <charconv>
+#include <cctype>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <deque>
+#include <iomanip>
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <climits>
+
+#if defined(__GNUC__) || defined(__clang__)
+#define DL_COMPUTED_GOTO
+#endif
+
+#ifndef DL_GEN_THREADS
+#define DL_GEN_THREADS 0
+#endif
 
 using namespace std;
 
-class Expression
+struct ArrayObject;
+
+enum Keyword : unsigned char
 {
-public:
-	virtual Expression* eval(unordered_map<string, Expression*> &env) = 0;
-	virtual string getString() = 0;
-	virtual Expression* copy() = 0;
-	~Expression() = default;
+	KW_NONE,
+	KW_VAL,
+	KW_VAR,
+	KW_ADD,
+	KW_IF,
+	KW_THEN,
+	KW_ELSE,
+	KW_LET,
+	KW_IN,
+	KW_FUNCTION,
+	KW_CALL,
+	KW_SET,
+	KW_BLOCK,
+	KW_ARR,
+	KW_GEN,
+	KW_AT,
+	KW_ASSIGN,
+	KW_CONST,
+	KW_RECORD
 };
 
 
+const size_t no_offset = static_cast<size_t>(-1);
+
+
+struct AstNode
+{
+	Keyword kind;
+	int value;
+	unsigned first;
+	unsigned count;
+	size_t offset;
+};
 
-stack <Expression*> bad_ptr;
 
+struct Closure;
+struct AstRef;
 
-Expression* fromEnv(string _id, unordered_map<string, Expression*> env)
+struct Datum
 {
-	auto search = env.find(_id);
-	if (search != env.end())
+	enum Kind : unsigned char
 	{
-		return search->second;
-	}
-	else
+		NONE,
+		INT,
+		FUNCTION,
+		ARRAY,
+		NODE
+	};
+
+	Kind kind;
+	union
 	{
-		return nullptr;
-	}
-}
+		int number;
+		Closure* closure;
+		ArrayObject* array;
+		const AstRef* node;
+	};
 
+	Datum() : kind(NONE), number(0) {}
 
-class Value : public Expression
-{
-public:
-	Value(int val) : _val(val) {}
+	Datum(int number) : kind(INT), number(number) {}
 
+	Datum(Closure* closure) : kind(FUNCTION), closure(closure) {}
 
-	Expression* eval(unordered_map<string, Expression*> &env)
-	{
-		return copy();
-	}
+	Datum(ArrayObject* array) : kind(ARRAY), array(array) {}
 
+	Datum(const AstRef* node) : kind(NODE), node(node) {}
 
-	string getString()
-	{
-		return "(val " + to_string(_val) + ")";
-	}
+	string getString();
+};
 
 
-	Expression* copy()
+class Ast
+{
+public:
+	int make(Keyword kind, int value, const int* children, size_t count, size_t offset = no_offset)
 	{
-		return new Value(_val);
+		_nodes.push_back({ kind, value, static_cast<unsigned>(_items.size()), static_cast<unsigned>(count), offset });
+		_items.insert(_items.end(), children, children + count);
+		return static_cast<int>(_nodes.size() - 1);
 	}
 
 
-	int getVal()
+	int make(Keyword kind, int value, initializer_list<int> children, size_t offset = no_offset)
 	{
-		return _val;
+		return make(kind, value, children.begin(), children.size(), offset);
 	}
-private:
-	int _val;
-};
 
 
-int getValue(Expression* exp, unordered_map<string, Expression*> &env)
-{
-	Value* res_ptr = dynamic_cast<Value*>(exp->eval(env));
-	if (res_ptr == nullptr)
+	int make(Keyword kind, int value, const vector<int>& children, size_t offset = no_offset)
 	{
-		throw("ERROR");
+		return make(kind, value, children.data(), children.size(), offset);
 	}
-	return res_ptr->getVal();
-}
-
 
-class Variable : public Expression
-{
-public:
-	Variable(string _id) : _id(_id) {}
 
-
-	Expression* eval(unordered_map<string, Expression*> &env)
+	const AstNode& operator[](int node) const
 	{
-		Expression* var = fromEnv(_id, env);
-		if (var == nullptr)
-			throw "ERROR";
-		return var;
+		return _nodes[node];
 	}
 
 
-	string getString()
+	int child(int node, size_t i) const
 	{
-		return "(var " + _id + ")";
+		return _items[_nodes[node].first + i];
 	}
 
 
-	Expression* copy()
+	void setChild(int node, size_t i, int child)
 	{
-		return new Variable(_id);
+		_items[_nodes[node].first + i] = child;
 	}
-private:
-	string _id;
-	friend class Call;
-};
 
 
-class Add : public Expression
-{
-public:
-	Add(Expression* left, Expression* right) : _left(left), _right(right) {}
+	int rebuild(int node, const vector<int>& children)
+	{
+		const AstNode& n = _nodes[node];
+		if (n.count == children.size() && equal(children.begin(), children.end(), _items.begin() + n.first))
+			return node;
+		return make(n.kind, n.value, children, n.offset);
+	}
 
 
-	Expression* eval(unordered_map<string, Expression*> &env)
+	size_t size() const
 	{
-		Expression* value = new Value(getValue(_left, env) + getValue(_right, env));
-		bad_ptr.push(value);
-		return value;
+		return _nodes.size();
 	}
 
 
-	Expression* copy()
+	int constant(const Datum& datum, size_t offset)
 	{
-		return new Add(_left->copy(), _right->copy());
+		_constants.push_back(datum);
+		return make(KW_CONST, static_cast<int>(_constants.size() - 1), {}, offset);
 	}
 
 
-	string getString()
+	const Datum& constantAt(int id) const
 	{
-		return "(add " + _left->getString() + " " + _right->getString() + ")";
+		return _constants[id];
 	}
 
 
-	~Add()
+	int intern(string_view name)
 	{
-		delete _left;
-		delete _right;
+		auto search = _name_ids.find(name);
+		if (search != _name_ids.end())
+			return search->second;
+		_names.emplace_back(name);
+		int id = static_cast<int>(_names.size() - 1);
+		_name_ids[_names.back()] = id;
+		return id;
 	}
-private:
-	Expression* _left, * _right;
-};
 
 
-class If : public Expression
-{
-public:
-	If(Expression* e1, Expression* e2, Expression* e_then, Expression* e_else) : _e1(e1), _e2(e2), _e_then(e_then), _e_else(e_else) {}
+	const string& name(int id) const
+	{
+		return _names[id];
+	}
 
 
-	Expression* eval(unordered_map<string, Expression*> &env)
+	size_t namesAmount() const
 	{
-		if (getValue(_e1->eval(env), env) > getValue(_e2->eval(env), env))
-		{
-			return _e_then->eval(env);
-		}
-		else
-		{
-			return _e_else->eval(env);
-		}
+		return _names.size();
 	}
 
 
-	string getString()
+	void collectAssigned(int node, vector<bool>& names) const
 	{
-		return "(if " + _e1->getString() + " " + _e2->getString() + " " + _e_then->getString() + " " + _e_else->getString() + ")";
+		const AstNode& n = _nodes[node];
+		if (n.kind == KW_SET)
+			names[n.value] = true;
+		for (size_t i = 0; i < n.count; ++i)
+			collectAssigned(_items[n.first + i], names);
 	}
 
 
-	Expression* copy()
+	string getString(int node) const
 	{
-		return new If(_e1->copy(), _e2->copy(), _e_then->copy(), _e_else->copy());
+		const AstNode& n = _nodes[node];
+		switch (n.kind)
+		{
+		case KW_VAL:
+			return "(val " + to_string(n.value) + ")";
+		case KW_VAR:
+			return "(var " + name(n.value) + ")";
+		case KW_ADD:
+			return "(add " + getString(child(node, 0)) + " " + getString(child(node, 1)) + ")";
+		case KW_IF:
+			return "(if " + getString(child(node, 0)) + " " + getString(child(node, 1)) + " " + getString(child(node, 2)) + " " + getString(child(node, 3)) + ")";
+		case KW_LET:
+			return "(let " + name(n.value) + " = " + getString(child(node, 0)) + " in " + getString(child(node, 1)) + ")";
+		case KW_FUNCTION:
+			return "(function " + name(n.value) + " = " + getString(child(node, 0)) + ")";
+		case KW_CALL:
+			return "(call " + getString(child(node, 0)) + " " + getString(child(node, 1)) + ")";
+		case KW_SET:
+			return "(set " + name(n.value) + " " + getString(child(node, 0)) + ")";
+		case KW_BLOCK:
+		case KW_ARR:
+		{
+			string result = n.kind == KW_BLOCK ? "(block " : "(arr ";
+			for (size_t i = 0; i < n.count; ++i)
+			{
+				result += getString(child(node, i));
+				result += " ";
+			}
+			result += ")";
+			return result;
+		}
+		case KW_GEN:
+			return "(gen " + getString(child(node, 0)) + " " + getString(child(node, 1)) + ")";
+		case KW_AT:
+			return "(at " + getString(child(node, 0)) + " " + getString(child(node, 1)) + ")";
+		case KW_CONST:
+		{
+			Datum datum = _constants[n.value];
+			return datum.getString();
+		}
+		case KW_RECORD:
+			return getString(child(node, 0));
+		default:
+			throw "ERROR";
+		}
 	}
 
 
-	~If()
+	static const char* typeName(Keyword kind)
 	{
-		delete _e1;
-		delete _e2;
-		delete _e_then;
-		delete _e_else;
+		switch (kind)
+		{
+		case KW_VAL:
+			return "Value";
+		case KW_VAR:
+			return "Variable";
+		case KW_ADD:
+			return "Add";
+		case KW_IF:
+			return "If";
+		case KW_LET:
+			return "Let";
+		case KW_FUNCTION:
+			return "Function";
+		case KW_CALL:
+			return "Call";
+		case KW_SET:
+			return "Set";
+		case KW_BLOCK:
+			return "Block";
+		case KW_ARR:
+			return "Arr";
+		case KW_GEN:
+			return "Gen";
+		case KW_AT:
+			return "At";
+		case KW_CONST:
+			return "Const";
+		case KW_RECORD:
+			return "Record";
+		default:
+			return "Program";
+		}
 	}
 private:
-	Expression* _e1, * _e2, * _e_then, * _e_else;
+	vector<AstNode> _nodes;
+	vector<int> _items;
+	deque<string> _names;
+	unordered_map<string_view, int> _name_ids;
+	vector<Datum> _constants;
 };
 
 
-class Let : public Expression
+struct AstRef
 {
-public:
-	Let(string _id, Expression* e1, Expression* e2) : _id(_id), _e1(e1), _e2(e2) {}
+	const Ast* ast;
+	int node;
 
 
-	Expression* eval(unordered_map<string, Expression*> &env)
+	string getString() const
 	{
-		env[_id] = _e1->eval(env);
-		return _e2->eval(env);
+		return ast->getString(node);
 	}
+};
 
 
-	string getString()
-	{
-		return "(let " + _id + " = " + _e1->getString() + " in " + _e2->getString() + ")";
-	}
+struct Function : AstRef
+{
+	size_t entry = 0;
+	int slots_amount = 0;
+	bool heap_frame = false;
+	bool pure = false;
+	bool deterministic = false;
+	bool memoize = false;
+
+	Function(const Ast* ast, int node) : AstRef{ ast, node } {}
+};
 
 
-	Expression* copy()
+struct Object
+{
+	enum Type : unsigned char
 	{
-		return new Let(_id, _e1->copy(), _e2->copy());
-	}
+		ARRAY,
+		CLOSURE,
+		FRAME
+	};
 
+	Type type;
+	bool marked = false;
+	unsigned short owner = 0;
 
-	~Let()
-	{
-		delete _e1;
-		delete _e2;
-	}
-private:
-	Expression* _e1, * _e2;
-	string _id;
+	Object(Type type) : type(type) {}
+
+	virtual ~Object() = default;
 };
 
 
-class Function : public Expression
+struct ArrayObject : Object
 {
-public:
-	Function(string _id, Expression* exp) : _id(_id), _exp(exp) {}
+	vector<int> numbers;
+	vector<Datum> elements;
+	bool packed = true;
 
+	ArrayObject() : Object(ARRAY) {}
 
-	Expression* eval(unordered_map<string, Expression*> &env)
+
+	size_t size() const
 	{
-		return copy();
+		return packed ? numbers.size() : elements.size();
 	}
 
 
-	string getString()
+	Datum at(size_t id) const
 	{
-		return "(function " + _id + " = " + _exp->getString() + ")";
+		return packed ? Datum(numbers[id]) : elements[id];
 	}
 
 
-	Expression* copy()
-	{
-		return new Function(_id, _exp->copy());
-	}
-	~Function()
+	void push(const Datum& datum)
 	{
-		delete _exp;
+		if (packed && datum.kind != Datum::INT)
+			box();
+		if (packed)
+			numbers.push_back(datum.number);
+		else
+			elements.push_back(datum);
 	}
-private:
-	string _id;
-	Expression* _exp;
-	friend class Call;
-};
 
 
-class Call : public Expression
-{
-public:
-	Call(Expression* f_exp, Expression* arg_exp) : _f_exp(f_exp), _arg_exp(arg_exp) {}
+	void box()
+	{
+		if (!packed)
+			return;
+		elements.reserve(numbers.capacity());
+		for (int number : numbers)
+			elements.push_back(Datum(number));
+		vector<int>().swap(numbers);
+		packed = false;
+	}
 
 
-	Expression* eval(unordered_map<string, Expression*> &env)
+	void pack()
 	{
-		Function* func = dynamic_cast<Function*>(_f_exp->eval(env));
-		if (func == nullptr)
+		if (packed)
+			return;
+		for (auto& element : elements)
 		{
-			throw "err";
+			if (element.kind != Datum::INT)
+				return;
 		}
-		Variable* var = dynamic_cast<Variable*>(_f_exp);
-		if (var != nullptr)
-		{
-			if (fromEnv(var->_id, env) == nullptr)
-			{
-				throw "Err";
-			}
-		}
-		env[func->_id] = _arg_exp->eval(env);
-		return func->_exp->eval(env);
+		numbers.reserve(elements.size());
+		for (auto& element : elements)
+			numbers.push_back(element.number);
+		vector<Datum>().swap(elements);
+		packed = true;
 	}
 
-	string getString()
+
+	void clear()
 	{
-		return "(call " + _f_exp->getString() + " " + _arg_exp->getString() + ")";
+		numbers.clear();
+		elements.clear();
+		packed = true;
 	}
+};
 
 
-	Expression* copy()
-	{
-		return new Call(_f_exp->copy(), _arg_exp->copy());
-	}
+struct Frame : Object
+{
+	Frame* parent;
+	vector<Datum> slots;
 
-	~Call()
-	{
-		delete _f_exp;
-		delete _arg_exp;
-	}
+	Frame(Frame* parent, size_t slots_amount) : Object(FRAME), parent(parent), slots(slots_amount) {}
+};
 
-private:
-	Expression* _f_exp, * _arg_exp;
+
+struct Closure : Object
+{
+	Function* function;
+	Frame* parent;
+
+	Closure(Function* function, Frame* parent) : Object(CLOSURE), function(function), parent(parent) {}
 };
 
 
-class Set : public Expression
+class Heap
 {
 public:
-	Set(string _id, Expression* e_val) :_id(_id), _e_val(e_val) {};
+	Heap(unsigned short id = 0) : _id(id) {}
 
-	Expression* eval(unordered_map<string, Expression*> &env)
+
+	ArrayObject* newArray(size_t capacity)
 	{
-		env[_id] = _e_val->eval(env);
-		return copy();
+		ArrayObject* arr = new ArrayObject;
+		arr->numbers.reserve(capacity);
+		return track(arr, sizeof(ArrayObject) + capacity * sizeof(int));
 	}
-	Expression* copy()
+
+
+	Frame* newFrame(Frame* parent, size_t slots_amount)
 	{
-		return new Set(_id, _e_val->copy());
+		return track(new Frame(parent, slots_amount), sizeof(Frame) + slots_amount * sizeof(Datum));
 	}
 
-	string getString()
+
+	Closure* newClosure(Function* function, Frame* parent)
 	{
-		return "(set " + _id + " " + _e_val->getString() + ")";
+		return track(new Closure(function, parent), sizeof(Closure));
 	}
 
-	~Set()
+
+	bool needsCollect()
 	{
-		delete _e_val;
+		return _allocated > _next_collect;
 	}
 
-private:
-	string _id;
-	Expression* _e_val;
-};
 
-class Block : public Expression
-{
-public:
+	size_t allocations() const
+	{
+		return _allocations;
+	}
+
 
-	Block(vector<Expression*>& income_vector) : _expr_vector(income_vector) {}
+	size_t allocatedBytes() const
+	{
+		return _allocated_bytes;
+	}
 
-	Expression* eval(unordered_map<string, Expression*> &env)
+
+	void mark(Object* object)
 	{
-		vector<Expression*> eval_vector;
-		for (auto iter : _expr_vector)
+		if (object != nullptr && object->owner == _id && !object->marked)
 		{
-			eval_vector.push_back(iter->eval(env));
+			object->marked = true;
+			_gray.push_back(object);
 		}
-		return eval_vector[_expr_vector.size() - 1];
+	}
 
+
+	void mark(const Datum& datum)
+	{
+		if (datum.kind == Datum::ARRAY)
+			mark(datum.array);
+		else if (datum.kind == Datum::FUNCTION)
+			mark(datum.closure);
 	}
 
-	Expression* copy()
+
+	void collect()
 	{
-		vector<Expression*> copy_vector;
-		for (auto iter : _expr_vector)
+		while (!_gray.empty())
+		{
+			Object* object = _gray.back();
+			_gray.pop_back();
+			trace(object);
+		}
+		size_t live = 0;
+		size_t kept = 0;
+		for (Object* object : _objects)
 		{
-			copy_vector.push_back(iter->copy());
+			if (!object->marked)
+			{
+				delete object;
+				continue;
+			}
+			object->marked = false;
+			live += sizeOf(object);
+			_objects[kept++] = object;
 		}
-		return new Block(copy_vector);
+		_objects.resize(kept);
+		_allocated = live;
+		_next_collect = max(min_collect, live * 2);
 	}
 
-	string getString()
+
+	void adopt(Heap& other)
 	{
-		string result = "";
-		result += "(block ";
-		for (auto iter : _expr_vector)
+		for (Object* object : other._objects)
 		{
-			result += iter->getString();
-			result += " ";
+			object->owner = _id;
+			_objects.push_back(object);
 		}
-		result += ")";
-		return result;
+		_allocated += other._allocated;
+		_allocations += other._allocations;
+		_allocated_bytes += other._allocated_bytes;
+		other._objects.clear();
+		other._allocated = 0;
 	}
 
-	~Block()
-	{}
 
+	~Heap()
+	{
+		for (Object* object : _objects)
+			delete object;
+	}
 private:
-	vector<Expression*> _expr_vector;
-};
-
-
-class Arr : public Expression
-{
-public:
-	Arr() {}
+	static constexpr size_t min_collect = 1 << 20;
 
-	Arr(vector<Expression*>& income_vector) : _arr(income_vector) {}
+	unsigned short _id;
+	vector<Object*> _objects;
+	vector<Object*> _gray;
+	size_t _allocated = 0;
+	size_t _next_collect = min_collect;
+	size_t _allocations = 0;
+	size_t _allocated_bytes = 0;
 
-	~Arr()
-	{}
 
-	Expression* eval(unordered_map<string, Expression*> &env)
+	template <typename T>
+	T* track(T* object, size_t bytes)
 	{
-		vector<Expression*> evals;
-		for (auto iter : _arr)
-			evals.push_back(iter->eval(env));
-		Expression* arr_eval = new Arr(evals);
-		return arr_eval;
+		object->owner = _id;
+		_objects.push_back(object);
+		_allocated += bytes;
+		++_allocations;
+		_allocated_bytes += bytes;
+		return object;
 	}
 
-	Expression* copy()
-	{
-		vector<Expression*> copy_vector;
-		for (auto iter : _arr)
-			copy_vector.push_back(iter->copy());
-		return new Arr(copy_vector);
-	}
 
-	Expression* operator[](int id)
+	void trace(Object* object)
 	{
-		if (id < 0 || id > _arr.size() - 1)
+		switch (object->type)
 		{
-			throw "ERROR";
+		case Object::ARRAY:
+			for (auto& element : static_cast<ArrayObject*>(object)->elements)
+				mark(element);
+			break;
+		case Object::CLOSURE:
+			mark(static_cast<Closure*>(object)->parent);
+			break;
+		case Object::FRAME:
+			mark(static_cast<Frame*>(object)->parent);
+			for (auto& slot : static_cast<Frame*>(object)->slots)
+				mark(slot);
+			break;
 		}
-		return _arr[id];
 	}
 
-	string getString()
+
+	static size_t sizeOf(Object* object)
 	{
-		string result = "";
-		result += "(arr ";
-		for (size_t i = 0; i < _arr.size(); ++i)
+		switch (object->type)
 		{
-			result += _arr[i]->getString();
-			result += " ";
+		case Object::ARRAY:
+			return sizeof(ArrayObject) + static_cast<ArrayObject*>(object)->numbers.capacity() * sizeof(int) +
+				static_cast<ArrayObject*>(object)->elements.capacity() * sizeof(Datum);
+		case Object::FRAME:
+			return sizeof(Frame) + static_cast<Frame*>(object)->slots.size() * sizeof(Datum);
+		default:
+			return sizeof(Closure);
 		}
-		result += ")";
-		return result;
 	}
+};
+
+
+int getValue(const Datum& datum)
+{
+	if (datum.kind != Datum::INT)
+	{
+		throw("ERROR");
+	}
+	return datum.number;
+}
 
-private:
-	friend class Gen;
-	friend class At;
-	vector<Expression*> _arr;
+
+enum OpCode
+{
+	OP_CONST,
+	OP_INT,
+	OP_LOAD_LOCAL,
+	OP_LOAD_OUTER,
+	OP_LOAD_GLOBAL,
+	OP_STORE_LOCAL,
+	OP_STORE_OUTER,
+	OP_STORE_GLOBAL,
+	OP_ADD,
+	OP_JUMP,
+	OP_JUMP_NOT_GREATER,
+	OP_POP,
+	OP_CLOSURE,
+	OP_CALL,
+	OP_TAILCALL,
+	OP_RETURN,
+	OP_ARR,
+	OP_GEN_BEGIN,
+	OP_GEN_LOOP,
+	OP_GEN_FUNC,
+	OP_GEN_INDEX,
+	OP_GEN_STORE,
+	OP_AT,
+	OP_RECORD,
+	OP_HALT
+};
+
+
+struct SourceMark
+{
+	Keyword kind;
+	size_t offset;
+};
+
+
+struct Program
+{
+	vector<int> code;
+	vector<SourceMark> source_map;
+	vector<Datum> constants;
+	vector<unique_ptr<Function>> functions;
+	vector<unique_ptr<AstRef>> nodes;
+	vector<unique_ptr<Closure>> static_closures;
+	size_t call_entry = 0;
+	size_t main_slots = 0;
+	size_t globals_amount = 0;
+	size_t records_amount = 0;
+};
+
+
+struct FunctionScope
+{
+	vector<pair<int, int>> names;
+	int slots_amount = 0;
+	bool heap_frame = false;
+	bool captures = false;
+	bool writes_outer = false;
+	bool reads_mutable = false;
+	int calls = 0;
 };
 
-class Gen : public Expression
+
+class Compiler
 {
 public:
-	Gen(Expression* e_length, Expression* e_func) :_e_length(e_length), _e_func(e_func) {}
+	Compiler(const Ast& ast, bool source_map = false) :
+		_ast(ast), _global_slots(ast.namesAmount(), -1), _assigned(ast.namesAmount()), _source_map(source_map) {}
+
 
-	Expression* eval(unordered_map<string, Expression*> &env)
+	Program compileProgram(int root)
 	{
-		vector<Expression*> _e_val;
-		Arr* gen_arr = new Arr;
-		int len = getValue(_e_length->eval(env), env);
-		for (size_t i = 0; i < len; ++i)
+		_ast.collectAssigned(root, _assigned);
+		beginFunction();
+		compile(root);
+		emit(OP_HALT);
+		_program.call_entry = position();
+		emit(OP_CALL);
+		emit(OP_HALT);
+		_program.main_slots = endFunction().slots_amount;
+		_program.globals_amount = _globals_amount;
+		return move(_program);
+	}
+private:
+	const Ast& _ast;
+	Program _program;
+	vector<FunctionScope> _scopes;
+	vector<int> _global_slots;
+	int _globals_amount = 0;
+	vector<bool> _assigned;
+	int _tail = -1;
+	bool _source_map;
+	SourceMark _mark = { KW_NONE, no_offset };
+
+
+	void compile(int node)
+	{
+		SourceMark mark = _mark;
+		const AstNode& n = _ast[node];
+		_mark.kind = n.kind;
+		if (n.offset != no_offset)
+			_mark.offset = n.offset;
+		bool tail = _tail == node;
+		switch (n.kind)
+		{
+		case KW_VAL:
+			emit(OP_INT);
+			emit(n.value);
+			break;
+		case KW_VAR:
+			emitLoad(n.value);
+			break;
+		case KW_ADD:
+			compile(_ast.child(node, 0));
+			compile(_ast.child(node, 1));
+			emit(OP_ADD);
+			break;
+		case KW_IF:
+		{
+			compile(_ast.child(node, 0));
+			compile(_ast.child(node, 1));
+			size_t to_else = emitJump(OP_JUMP_NOT_GREATER);
+			compileBranch(_ast.child(node, 2), tail);
+			size_t to_end = emitJump(OP_JUMP);
+			patchJump(to_else);
+			compileBranch(_ast.child(node, 3), tail);
+			patchJump(to_end);
+			break;
+		}
+		case KW_LET:
+		{
+			int slot = declare(n.value);
+			compile(_ast.child(node, 0));
+			emit(OP_STORE_LOCAL);
+			emit(slot);
+			compileBranch(_ast.child(node, 1), tail);
+			undeclare();
+			break;
+		}
+		case KW_FUNCTION:
+			compileFunction(node);
+			break;
+		case KW_CALL:
+			compile(_ast.child(node, 0));
+			compile(_ast.child(node, 1));
+			emit(tail ? OP_TAILCALL : OP_CALL);
+			++_scopes.back().calls;
+			break;
+		case KW_SET:
+			compile(_ast.child(node, 1));
+			emitStore(n.value);
+			_program.nodes.emplace_back(new AstRef{ &_ast, node });
+			emitConstant(_program.nodes.back().get());
+			break;
+		case KW_BLOCK:
 		{
-			Expression* arr_el = new Call(_e_func, new Value(i));
-			gen_arr->_arr.push_back(arr_el->eval(env));
+			if (n.count == 0)
+				throw "ERROR";
+			for (size_t i = 0; i + 1 < n.count; ++i)
+			{
+				compile(_ast.child(node, i));
+				emit(OP_POP);
+			}
+			compileBranch(_ast.child(node, n.count - 1), tail);
+			break;
+		}
+		case KW_ARR:
+			for (size_t i = 0; i < n.count; ++i)
+				compile(_ast.child(node, i));
+			emit(OP_ARR);
+			emit(static_cast<int>(n.count));
+			break;
+		case KW_GEN:
+			compileGen(node);
+			break;
+		case KW_AT:
+			compile(_ast.child(node, 0));
+			compile(_ast.child(node, 1));
+			emit(OP_AT);
+			break;
+		case KW_CONST:
+			emitConstant(_ast.constantAt(n.value));
+			break;
+		case KW_RECORD:
+			compile(_ast.child(node, 0));
+			emit(OP_RECORD);
+			emit(n.value);
+			_program.records_amount = max<size_t>(_program.records_amount, n.value + 1);
+			break;
+		default:
+			throw "ERROR";
 		}
-		return gen_arr;
+		_mark = mark;
 	}
 
-	Expression* copy()
-	{
-		return new Gen(_e_length->copy(), _e_func->copy());
-	}
 
-	string getString()
+	void compileBranch(int node, bool tail)
 	{
-		return "(gen " + _e_length->getString() + " " + _e_func->getString() + ")";
+		if (tail)
+			compileTail(node);
+		else
+			compile(node);
 	}
 
-	~Gen()
+
+	void compileTail(int node)
 	{
-		delete _e_length;
-		delete _e_func;
+		_tail = node;
+		compile(node);
 	}
 
-private:
-	Expression* _e_length;
-	Expression* _e_func;
-};
-
-class At : public Expression
-{
-public:
-	At(Expression* e_array, Expression* e_index) :_e_array(e_array), _e_index(e_index) {}
 
-	Expression* eval(unordered_map<string, Expression*> &env)
+	void compileFunction(int node)
 	{
-		Arr* at_arr = dynamic_cast<Arr*>(_e_array->eval(env));
-		if (at_arr == nullptr)
-		{
-			throw "ERROR";
-		}
-		int id = getValue(_e_index->eval(env), env);
-		if (id < 0 || id > at_arr->_arr.size() - 1)
+		size_t to_end = emitJump(OP_JUMP);
+		_program.functions.emplace_back(new Function(&_ast, node));
+		Function* func = _program.functions.back().get();
+		int id = static_cast<int>(_program.functions.size() - 1);
+		func->entry = position();
+		beginFunction();
+		declare(_ast[node].value);
+		compileTail(_ast.child(node, 1));
+		emit(OP_RETURN);
+		FunctionScope scope = endFunction();
+		func->slots_amount = scope.slots_amount;
+		func->heap_frame = scope.heap_frame;
+		func->pure = !scope.writes_outer;
+		func->deterministic = func->pure && !scope.reads_mutable;
+		func->memoize = func->deterministic && scope.calls >= 2;
+		patchJump(to_end);
+		if (!scope.captures)
 		{
-			throw "ERROR";
+			_program.static_closures.emplace_back(new Closure(func, nullptr));
+			_program.static_closures.back()->marked = true;
+			emitConstant(_program.static_closures.back().get());
+			return;
 		}
-		return (*at_arr)[id];
+		emit(OP_CLOSURE);
+		emit(id);
 	}
 
-	Expression* copy()
+
+	void compileGen(int node)
 	{
-		return new At(_e_array, _e_index);
+		int e_length = _ast.child(node, 0);
+		int e_func = _ast.child(node, 1);
+		bool hoisted = _ast[e_func].kind == KW_FUNCTION;
+		if (hoisted)
+			compile(e_func);
+		compile(e_length);
+		emit(OP_GEN_BEGIN);
+		emit(hoisted);
+		size_t loop = position();
+		size_t to_end = emitJump(OP_GEN_LOOP);
+		if (hoisted)
+			emit(OP_GEN_FUNC);
+		else
+			compile(e_func);
+		emit(OP_GEN_INDEX);
+		emit(OP_CALL);
+		emit(OP_GEN_STORE);
+		emit(OP_JUMP);
+		emit(static_cast<int>(loop));
+		patchJump(to_end);
 	}
 
-	string getString()
+
+	void emit(int word)
 	{
-		return "(at " + _e_array->getString() + " " + _e_index->getString() + ")";
+		_program.code.push_back(word);
+		if (_source_map)
+			_program.source_map.push_back(_mark);
 	}
 
-	~At()
+
+	void emitConstant(Datum datum)
 	{
-		delete _e_array;
-		delete _e_index;
+		_program.constants.push_back(datum);
+		emit(OP_CONST);
+		emit(static_cast<int>(_program.constants.size() - 1));
 	}
-private:
-	Expression* _e_array;
-	Expression* _e_index;
-};
 
 
-void tokenizer(istream& in, list <string>& tokens)
-{
-	string lexem_str;
-	stringstream str;
-
-	while (in >> str.rdbuf());
+	size_t emitJump(OpCode op)
+	{
+		emit(op);
+		emit(0);
+		return _program.code.size() - 1;
+	}
 
-	lexem_str = str.str();
 
-	for (size_t i = 0; i < lexem_str.length(); ++i)
+	void patchJump(size_t operand)
 	{
-		if (lexem_str[i] == '(')
-		{
-			lexem_str.insert(i + 1, " ");
-		}
-		else if (lexem_str[i] == ')')
-		{
-			lexem_str.insert(i++, " ");
-		}
+		_program.code[operand] = static_cast<int>(_program.code.size());
 	}
-	stringstream lexem_stream(lexem_str);
 
-	while (lexem_stream >> lexem_str)
+
+	size_t position()
 	{
-		tokens.push_back(lexem_str);
+		return _program.code.size();
 	}
-}
 
 
-Expression* parser(list <string>& tokens)
-{
-	Expression* res_exp = nullptr;
-	string operation;
-	while (!tokens.empty())
+	void beginFunction()
 	{
-		operation = tokens.front();
-		tokens.pop_front();
+		_scopes.emplace_back();
+	}
 
-		if (operation == "(")
-		{
-			return parser(tokens);
-		}
 
-		else if (operation == ")")
-		{
-			return res_exp;
-		}
+	FunctionScope endFunction()
+	{
+		FunctionScope scope = move(_scopes.back());
+		_scopes.pop_back();
+		return scope;
+	}
 
-		else if (operation == "val")
-		{
-			res_exp = new Value(stoi(tokens.front()));
-			tokens.pop_front();
-		}
 
-		else if (operation == "var")
-		{
-			res_exp = new Variable(tokens.front());
-			tokens.pop_front();
-		}
+	int declare(int id)
+	{
+		FunctionScope &scope = _scopes.back();
+		scope.names.push_back({ id, scope.slots_amount });
+		return scope.slots_amount++;
+	}
 
-		else if (operation == "add")
-		{
-			Expression* e1, * e2;
-			e1 = parser(tokens);
-			e2 = parser(tokens);
-			res_exp = new Add(e1, e2);
-		}
 
-		else if (operation == "let")
-		{
-			string _id;
-			Expression* e1, * e2;
-			_id = tokens.front();
-			tokens.pop_front();
+	void undeclare()
+	{
+		_scopes.back().names.pop_back();
+	}
 
-			if (tokens.front() != "=")
-				throw "ERROR";
 
-			tokens.pop_front();
-			e1 = parser(tokens);
+	void emitLoad(int id)
+	{
+		size_t depth = emitAccess(id, OP_LOAD_LOCAL, OP_LOAD_OUTER, OP_LOAD_GLOBAL);
+		if (depth > 0 && _assigned[id])
+			_scopes.back().reads_mutable = true;
+	}
+
 
-			if (tokens.front() != "in")
-				throw "ERROR";
+	void emitStore(int id)
+	{
+		size_t depth = emitAccess(id, OP_STORE_LOCAL, OP_STORE_OUTER, OP_STORE_GLOBAL);
+		for (size_t level = 0; level < depth && level < _scopes.size(); ++level)
+			_scopes[_scopes.size() - 1 - level].writes_outer = true;
+	}
 
-			tokens.pop_front();
-			e2 = parser(tokens);
 
-			res_exp = new Let(_id, e1, e2);
+	size_t emitAccess(int id, OpCode local, OpCode outer, OpCode global)
+	{
+		for (size_t depth = 0; depth < _scopes.size(); ++depth)
+		{
+			const auto& names = _scopes[_scopes.size() - 1 - depth].names;
+			for (size_t i = names.size(); i-- > 0;)
+			{
+				if (names[i].first != id)
+					continue;
+				if (depth == 0)
+				{
+					emit(local);
+				}
+				else
+				{
+					for (size_t level = 1; level <= depth; ++level)
+					{
+						_scopes[_scopes.size() - level].captures = true;
+						_scopes[_scopes.size() - 1 - level].heap_frame = true;
+					}
+					emit(outer);
+					emit(static_cast<int>(depth));
+				}
+				emit(names[i].second);
+				return depth;
+			}
 		}
+		if (_global_slots[id] < 0)
+			_global_slots[id] = _globals_amount++;
+		emit(global);
+		emit(_global_slots[id]);
+		return _scopes.size();
+	}
+};
 
-		else if (operation == "if")
-		{
-			Expression* e1, * e2, * e_then, * e_else;
-			e1 = parser(tokens);
-			e2 = parser(tokens);
 
-			if (tokens.front() != "then")
-				throw "ERROR";
+class Optimizer
+{
+public:
+	Optimizer(Ast& ast) : _ast(ast), _assigned(ast.namesAmount()) {}
 
-			tokens.pop_front();
-			e_then = parser(tokens);
 
-			if (tokens.front() != "else")
-				throw "ERROR";
+	int optimizeProgram(int root)
+	{
+		_ast.collectAssigned(root, _assigned);
+		return optimize(root);
+	}
+private:
+	Ast& _ast;
+	vector<bool> _assigned;
+	vector<pair<int, int>> _bindings;
 
-			tokens.pop_front();
-			e_else = parser(tokens);
-			res_exp = new If(e1, e2, e_then, e_else);
-		}
 
-		else if (operation == "function")
+	int optimize(int node)
+	{
+		AstNode n = _ast[node];
+		switch (n.kind)
 		{
-			string _id = tokens.front();
-			tokens.pop_front();
-			res_exp = new Function(_id, parser(tokens));
+		case KW_VAL:
+			return node;
+		case KW_VAR:
+		{
+			int constant = this->constant(n.value);
+			return constant >= 0 ? constant : node;
 		}
-
-		else if (operation == "call")
+		case KW_ADD:
 		{
-			Expression* e1, * e2;
-			e1 = parser(tokens);
-			e2 = parser(tokens);
-			res_exp = new Call(e1, e2);
+			int left = optimize(_ast.child(node, 0));
+			int right = optimize(_ast.child(node, 1));
+			if (isValue(left) && isValue(right))
+				return _ast.make(KW_VAL, _ast[left].value + _ast[right].value, {}, n.offset);
+			return _ast.rebuild(node, { left, right });
 		}
-
-		else if (operation == "set")
+		case KW_IF:
 		{
-			string _id = tokens.front();
-			tokens.pop_front();
-			res_exp = new Set(_id, parser(tokens));
+			int e1 = optimize(_ast.child(node, 0));
+			int e2 = optimize(_ast.child(node, 1));
+			if (isValue(e1) && isValue(e2))
+				return optimize(_ast.child(node, _ast[e1].value > _ast[e2].value ? 2 : 3));
+			int e_then = optimize(_ast.child(node, 2));
+			int e_else = optimize(_ast.child(node, 3));
+			return _ast.rebuild(node, { e1, e2, e_then, e_else });
 		}
-
-		else if (operation == "block")
+		case KW_LET:
 		{
-			vector<Expression*> expr;
-			Expression* e1;
-			while ((e1 = parser(tokens)) != nullptr)
+			bind(n.value);
+			int e1 = optimize(_ast.child(node, 0));
+			unbind();
+			if (isValue(e1) && !_assigned[n.value])
 			{
-				expr.push_back(e1);
+				bind(n.value, e1);
+				int e2 = optimize(_ast.child(node, 1));
+				unbind();
+				return e2;
 			}
-			res_exp = new Block(expr);
+			bind(n.value);
+			int e2 = optimize(_ast.child(node, 1));
+			unbind();
+			return _ast.rebuild(node, { e1, e2 });
 		}
-
-		else if (operation == "arr")
+		case KW_FUNCTION:
+			bind(n.value);
+			_ast.setChild(node, 1, optimize(_ast.child(node, 0)));
+			unbind();
+			return node;
+		case KW_SET:
+			_ast.setChild(node, 1, optimize(_ast.child(node, 0)));
+			return node;
+		case KW_BLOCK:
 		{
-			vector<Expression*> expr;
-			Expression* e1;
-			while ((e1 = parser(tokens)) != nullptr)
+			if (n.count == 0)
+				return node;
+			vector<int> expr;
+			for (size_t i = 0; i + 1 < n.count; ++i)
 			{
-				expr.push_back(e1);
+				int exp = optimize(_ast.child(node, i));
+				if (!isValue(exp) && _ast[exp].kind != KW_FUNCTION)
+					expr.push_back(exp);
 			}
-			res_exp = new Arr(expr);
+			expr.push_back(optimize(_ast.child(node, n.count - 1)));
+			if (expr.size() == 1)
+				return expr.back();
+			return _ast.rebuild(node, expr);
 		}
-
-		else if (operation == "gen")
+		default:
 		{
-			Expression* e1, * e2;
-			e1 = parser(tokens);
-			e2 = parser(tokens);
-			res_exp = new Gen(e1, e2);
+			vector<int> expr;
+			for (size_t i = 0; i < n.count; ++i)
+				expr.push_back(optimize(_ast.child(node, i)));
+			return _ast.rebuild(node, expr);
 		}
-
-		else if (operation == "at")
-		{
-			Expression* e1, * e2;
-			e1 = parser(tokens);
-			e2 = parser(tokens);
-			res_exp = new At(e1, e2);
 		}
+	}
 
-		else
-		{
-			throw "ERROR";
+
+	bool isValue(int node)
+	{
+		return _ast[node].kind == KW_VAL;
+	}
+
+
+	void bind(int id, int constant = -1)
+	{
+		_bindings.push_back({ id, constant });
+	}
+
+
+	void unbind()
+	{
+		_bindings.pop_back();
+	}
+
+
+	int constant(int id)
+	{
+		for (size_t i = _bindings.size(); i-- > 0;)
+		{
+			if (_bindings[i].first == id)
+				return _bindings[i].second;
+		}
+		return -1;
+	}
+};
+
+
+class AstWriter
+{
+public:
+	AstWriter(const Ast& ast) : _ast(ast) {}
+
+
+	void write(int node)
+	{
+		const AstNode& n = _ast[node];
+		_bytes.push_back(static_cast<char>(n.kind));
+		switch (n.kind)
+		{
+		case KW_VAL:
+			integer(n.value);
+			break;
+		case KW_VAR:
+			name(n.value);
+			break;
+		case KW_LET:
+			name(n.value);
+			write(_ast.child(node, 0));
+			write(_ast.child(node, 1));
+			break;
+		case KW_FUNCTION:
+		case KW_SET:
+			name(n.value);
+			write(_ast.child(node, 0));
+			break;
+		case KW_BLOCK:
+		case KW_ARR:
+			number(n.count);
+			for (size_t i = 0; i < n.count; ++i)
+				write(_ast.child(node, i));
+			break;
+		default:
+			for (size_t i = 0; i < n.count; ++i)
+				write(_ast.child(node, i));
+			break;
+		}
+	}
+
+
+	void number(uint64_t value)
+	{
+		while (value >= 0x80)
+		{
+			_bytes.push_back(static_cast<char>(value | 0x80));
+			value >>= 7;
+		}
+		_bytes.push_back(static_cast<char>(value));
+	}
+
+
+	void text(string_view value)
+	{
+		number(value.size());
+		_bytes += value;
+	}
+
+
+	const string& bytes()
+	{
+		return _bytes;
+	}
+private:
+	const Ast& _ast;
+	string _bytes;
+
+
+	void integer(int value)
+	{
+		uint32_t bits = static_cast<uint32_t>(value);
+		number((bits << 1) ^ (value < 0 ? 0xFFFFFFFFu : 0));
+	}
+
+
+	void name(int id)
+	{
+		text(_ast.name(id));
+	}
+};
+
+
+string Datum::getString()
+{
+	string result;
+	vector<pair<const ArrayObject*, size_t>> arrays;
+	Datum datum = *this;
+	for (;;)
+	{
+		switch (datum.kind)
+		{
+		case INT:
+			result += "(val " + to_string(datum.number) + ")";
+			break;
+		case FUNCTION:
+			result += datum.closure->function->getString();
+			break;
+		case NODE:
+			result += datum.node->getString();
+			break;
+		case ARRAY:
+			result += "(arr ";
+			arrays.push_back({ datum.array, 0 });
+			break;
+		default:
+			throw "ERROR";
+		}
+		if (datum.kind != ARRAY && !arrays.empty())
+			result += " ";
+		for (;;)
+		{
+			if (arrays.empty())
+				return result;
+			auto& top = arrays.back();
+			if (top.second < top.first->size())
+			{
+				datum = top.first->at(top.second++);
+				break;
+			}
+			result += ")";
+			arrays.pop_back();
+			if (!arrays.empty())
+				result += " ";
+		}
+	}
+}
+
+
+class WorkerPool
+{
+public:
+	WorkerPool(size_t size)
+	{
+		for (size_t i = 1; i < size; ++i)
+			_threads.emplace_back([this] { loop(); });
+	}
+
+
+	size_t size()
+	{
+		return _threads.size() + 1;
+	}
+
+
+	void run(size_t tasks, const function<void(size_t)>& task)
+	{
+		{
+			lock_guard<mutex> lock(_mutex);
+			_task = &task;
+			_tasks = tasks;
+			_next = 0;
+			_done = 0;
+			++_generation;
+		}
+		_wake.notify_all();
+		work();
+		unique_lock<mutex> lock(_mutex);
+		_finished.wait(lock, [this] { return _done == _tasks; });
+		_task = nullptr;
+	}
+
+
+	~WorkerPool()
+	{
+		{
+			lock_guard<mutex> lock(_mutex);
+			_stop = true;
+		}
+		_wake.notify_all();
+		for (auto& worker : _threads)
+			worker.join();
+	}
+private:
+	vector<thread> _threads;
+	mutex _mutex;
+	condition_variable _wake;
+	condition_variable _finished;
+	const function<void(size_t)>* _task = nullptr;
+	size_t _tasks = 0;
+	size_t _next = 0;
+	size_t _done = 0;
+	size_t _generation = 0;
+	bool _stop = false;
+
+
+	void loop()
+	{
+		size_t seen = 0;
+		for (;;)
+		{
+			{
+				unique_lock<mutex> lock(_mutex);
+				_wake.wait(lock, [&] { return _stop || _generation != seen; });
+				if (_stop)
+					return;
+				seen = _generation;
+			}
+			work();
+		}
+	}
+
+
+	void work()
+	{
+		for (;;)
+		{
+			const function<void(size_t)>* task;
+			size_t index;
+			{
+				lock_guard<mutex> lock(_mutex);
+				if (_task == nullptr || _next >= _tasks)
+					return;
+				task = _task;
+				index = _next++;
+			}
+			(*task)(index);
+			lock_guard<mutex> lock(_mutex);
+			if (++_done == _tasks)
+				_finished.notify_all();
+		}
+	}
+};
+
+
+class Profiler
+{
+public:
+	Profiler(const Program &program) : _program(program), _instructions(program.code.size()), _stacks(1, { nullptr, 0, 0, {} }) {}
+
+
+	void start(const Heap& heap)
+	{
+		_last = chrono::steady_clock::now();
+		_allocations = heap.allocations();
+		_bytes = heap.allocatedBytes();
+	}
+
+
+	void instruction(size_t position, const Heap& heap)
+	{
+		account(heap);
+		++_instructions[position].count;
+		_position = position;
+		_position_stack = _stack;
+	}
+
+
+	void finish(const Heap& heap)
+	{
+		account(heap);
+		_position = none;
+	}
+
+
+	void enter(const Function* func, size_t depth)
+	{
+		++_depths[bucket(depth)];
+		++_environments[bucket(func->slots_amount)];
+		if (_stack_depth == max_stack_depth)
+		{
+			++_overflow;
+			return;
+		}
+		++_stack_depth;
+		_stack = child(_stack, func);
+	}
+
+
+	void leave()
+	{
+		if (_overflow > 0)
+		{
+			--_overflow;
+			return;
+		}
+		--_stack_depth;
+		_stack = _stacks[_stack].parent;
+	}
+
+
+	void report(ostream& out, string_view source)
+	{
+		vector<size_t> lines = lineStarts(source);
+		Counters total;
+		unordered_map<string, Counters> types;
+		unordered_map<size_t, Counters> locations;
+		for (size_t i = 0; i < _instructions.size(); ++i)
+		{
+			const Counters& stats = _instructions[i];
+			if (stats.count == 0)
+				continue;
+			SourceMark mark = i < _program.source_map.size() ? _program.source_map[i] : SourceMark{ KW_NONE, no_offset };
+			total.add(stats);
+			types[Ast::typeName(mark.kind)].add(stats);
+			if (mark.offset != no_offset)
+				locations[mark.offset].add(stats);
+		}
+
+		out << "instructions " << total.count << ", time " << total.time / 1e6 << " ms, allocations "
+			<< total.allocations << " (" << total.bytes << " bytes)\n\n";
+		vector<pair<string, Counters>> type_rows(types.begin(), types.end());
+		printRows(out, "node", type_rows);
+
+		vector<pair<string, Counters>> location_rows;
+		for (auto& location : locations)
+			location_rows.push_back({ locationName(location.first, lines) + " " + snippet(source, location.first), location.second });
+		if (location_rows.size() > max_report_rows)
+		{
+			partial_sort(location_rows.begin(), location_rows.begin() + max_report_rows, location_rows.end(), slower);
+			location_rows.resize(max_report_rows);
+		}
+		out << "\n";
+		printRows(out, "location", location_rows);
+
+		out << "\ncall depth\n";
+		printHistogram(out, _depths);
+		out << "\nenvironment size\n";
+		printHistogram(out, _environments);
+	}
+
+
+	void writeFolded(ostream& out, string_view source)
+	{
+		vector<size_t> lines = lineStarts(source);
+		vector<string> paths(_stacks.size());
+		for (size_t i = 0; i < _stacks.size(); ++i)
+		{
+			paths[i] = i == 0 ? "main" : paths[_stacks[i].parent] + ";" + functionName(_stacks[i].function, lines);
+			if (_stacks[i].time > 0)
+				out << paths[i] << " " << _stacks[i].time << "\n";
+		}
+	}
+private:
+	struct Counters
+	{
+		size_t count = 0;
+		long long time = 0;
+		size_t allocations = 0;
+		size_t bytes = 0;
+
+
+		void add(const Counters& other)
+		{
+			count += other.count;
+			time += other.time;
+			allocations += other.allocations;
+			bytes += other.bytes;
+		}
+	};
+
+	struct StackNode
+	{
+		const Function* function;
+		size_t parent;
+		long long time;
+		unordered_map<const Function*, size_t> children;
+	};
+
+	static constexpr size_t none = static_cast<size_t>(-1);
+	static constexpr size_t max_stack_depth = 128;
+	static constexpr size_t max_report_rows = 20;
+	static constexpr size_t histogram_buckets = 65;
+
+	const Program &_program;
+	vector<Counters> _instructions;
+	vector<StackNode> _stacks;
+	size_t _stack = 0;
+	size_t _stack_depth = 0;
+	size_t _overflow = 0;
+	size_t _position = none;
+	size_t _position_stack = 0;
+	chrono::steady_clock::time_point _last;
+	size_t _allocations = 0;
+	size_t _bytes = 0;
+	size_t _depths[histogram_buckets] = {};
+	size_t _environments[histogram_buckets] = {};
+
+
+	void account(const Heap& heap)
+	{
+		chrono::steady_clock::time_point now = chrono::steady_clock::now();
+		if (_position != none)
+		{
+			long long elapsed = chrono::duration_cast<chrono::nanoseconds>(now - _last).count();
+			Counters& stats = _instructions[_position];
+			stats.time += elapsed;
+			stats.allocations += heap.allocations() - _allocations;
+			stats.bytes += heap.allocatedBytes() - _bytes;
+			_stacks[_position_stack].time += elapsed;
+		}
+		_last = now;
+		_allocations = heap.allocations();
+		_bytes = heap.allocatedBytes();
+	}
+
+
+	size_t child(size_t parent, const Function* func)
+	{
+		auto search = _stacks[parent].children.find(func);
+		if (search != _stacks[parent].children.end())
+			return search->second;
+		_stacks.push_back({ func, parent, 0, {} });
+		_stacks[parent].children[func] = _stacks.size() - 1;
+		return _stacks.size() - 1;
+	}
+
+
+	static size_t bucket(size_t value)
+	{
+		size_t result = 0;
+		for (; value > 0; value >>= 1)
+			++result;
+		return result;
+	}
+
+
+	static bool slower(const pair<string, Counters>& left, const pair<string, Counters>& right)
+	{
+		return left.second.time > right.second.time;
+	}
+
+
+	static vector<size_t> lineStarts(string_view source)
+	{
+		vector<size_t> lines = { 0 };
+		for (size_t i = 0; i < source.size(); ++i)
+		{
+			if (source[i] == '\n')
+				lines.push_back(i + 1);
+		}
+		return lines;
+	}
+
+
+	static string locationName(size_t offset, const vector<size_t>& lines)
+	{
+		size_t line = upper_bound(lines.begin(), lines.end(), offset) - lines.begin();
+		return to_string(line) + ":" + to_string(offset - lines[line - 1] + 1);
+	}
+
+
+	static string snippet(string_view source, size_t offset)
+	{
+		string text(source.substr(offset, 40));
+		replace_if(text.begin(), text.end(), [](char c) { return isspace(static_cast<unsigned char>(c)); }, ' ');
+		return text;
+	}
+
+
+	static string functionName(const Function* func, const vector<size_t>& lines)
+	{
+		const AstNode& node = (*func->ast)[func->node];
+		string name = func->ast->name(node.value);
+		replace(name.begin(), name.end(), ';', '_');
+		if (node.offset != no_offset)
+			name += "@" + locationName(node.offset, lines);
+		return name;
+	}
+
+
+	static void printRows(ostream& out, const string& title, vector<pair<string, Counters>>& rows)
+	{
+		sort(rows.begin(), rows.end(), slower);
+		out << left << setw(12) << title << right << setw(14) << "count" << setw(14) << "time ms"
+			<< setw(12) << "allocs" << setw(14) << "bytes" << "\n";
+		for (auto& row : rows)
+		{
+			out << left << setw(12) << row.first.substr(0, row.first.find(' ')) << right << setw(14) << row.second.count
+				<< setw(14) << fixed << setprecision(3) << row.second.time / 1e6 << defaultfloat
+				<< setw(12) << row.second.allocations << setw(14) << row.second.bytes;
+			if (row.first.find(' ') != string::npos)
+				out << "  " << row.first.substr(row.first.find(' ') + 1);
+			out << "\n";
+		}
+	}
+
+
+	static void printHistogram(ostream& out, const size_t (&histogram)[histogram_buckets])
+	{
+		for (size_t i = 0; i < histogram_buckets; ++i)
+		{
+			if (histogram[i] == 0)
+				continue;
+			size_t low = i == 0 ? 0 : size_t(1) << (i - 1);
+			size_t high = i == 0 ? 0 : (size_t(1) << (i - 1)) * 2 - 1;
+			string range = low == high ? to_string(low) : to_string(low) + "-" + to_string(high);
+			out << "  " << left << setw(24) << range << right << histogram[i] << "\n";
+		}
+	}
+};
+
+
+class VM
+{
+public:
+	VM(const Program &program, bool parallel_gen = true, Profiler* profiler = nullptr) :
+		_program(program), _globals(program.globals_amount), _parallel_gen(parallel_gen && profiler == nullptr), _profiler(profiler),
+		_records(program.records_amount) {}
+
+
+	Datum run()
+	{
+		_current = _heap.newFrame(nullptr, _program.main_slots);
+		if (_profiler == nullptr)
+			return execute<false>(_program.code.data());
+		_profiler->start(_heap);
+		try
+		{
+			Datum result = execute<true>(_program.code.data());
+			_profiler->finish(_heap);
+			return result;
+		}
+		catch (...)
+		{
+			_profiler->finish(_heap);
+			throw;
+		}
+	}
+
+
+	const vector<Datum>& records() const
+	{
+		return _records;
+	}
+private:
+	struct GenState
+	{
+		ArrayObject* arr;
+		Datum func;
+		int index;
+		int length;
+	};
+
+	struct CallFrame
+	{
+		Frame* current;
+		Frame* outer;
+		int return_pc;
+		unsigned base;
+	};
+
+	struct MemoEntry
+	{
+		Closure* closure;
+		int arg;
+		Datum result;
+	};
+
+	struct MemoCall
+	{
+		Closure* closure;
+		int arg;
+		size_t depth;
+		size_t impure_calls;
+	};
+
+	struct SpeculationAbort {};
+
+	enum Outcome : unsigned char
+	{
+		DONE,
+		FAILED,
+		ABORTED
+	};
+
+	static constexpr int parallel_gen_chunk = 1024;
+	static constexpr size_t memo_capacity = 1 << 12;
+
+	const Program &_program;
+	vector<Datum> _globals;
+	vector<Datum> _stack;
+	vector<Datum> _locals;
+	vector<CallFrame> _calls;
+	vector<GenState> _gens;
+	Frame* _current = nullptr;
+	Frame* _outer = nullptr;
+	unsigned _base = 0;
+	unsigned _locals_top = 0;
+	Heap _heap;
+	bool _speculative = false;
+	bool _parallel_gen = true;
+	unique_ptr<WorkerPool> _pool;
+	ArrayObject* _gen_target = nullptr;
+	int _gen_from = 0;
+	int _gen_done = 0;
+	vector<MemoEntry> _memo;
+	vector<MemoCall> _memo_calls;
+	size_t _impure_calls = 0;
+	Profiler* _profiler = nullptr;
+	vector<Datum> _records;
+
+
+	VM(const Program &program, const vector<Datum>& globals, unsigned short heap_id) :
+		_program(program), _globals(globals), _heap(heap_id), _speculative(true) {}
+
+
+	template <bool profiled>
+	Datum execute(const int* pc)
+	{
+		const int* code = _program.code.data();
+		Datum* locals = _current != nullptr ? _current->slots.data() : _locals.data() + _base;
+
+#ifdef DL_COMPUTED_GOTO
+		static void* const targets[] = {
+			&&target_OP_CONST, &&target_OP_INT, &&target_OP_LOAD_LOCAL, &&target_OP_LOAD_OUTER, &&target_OP_LOAD_GLOBAL,
+			&&target_OP_STORE_LOCAL, &&target_OP_STORE_OUTER, &&target_OP_STORE_GLOBAL, &&target_OP_ADD, &&target_OP_JUMP,
+			&&target_OP_JUMP_NOT_GREATER, &&target_OP_POP, &&target_OP_CLOSURE, &&target_OP_CALL, &&target_OP_TAILCALL, &&target_OP_RETURN,
+			&&target_OP_ARR, &&target_OP_GEN_BEGIN, &&target_OP_GEN_LOOP, &&target_OP_GEN_FUNC, &&target_OP_GEN_INDEX, &&target_OP_GEN_STORE,
+			&&target_OP_AT, &&target_OP_RECORD, &&target_OP_HALT
+		};
+#define TARGET(op) target_##op:
+#define DISPATCH() { if (profiled) _profiler->instruction(pc - code, _heap); goto *targets[*pc++]; }
+		DISPATCH();
+#else
+#define TARGET(op) case op:
+#define DISPATCH() break
+		for (;;)
+		{
+			if (profiled)
+				_profiler->instruction(pc - code, _heap);
+			switch (*pc++)
+			{
+#endif
+		TARGET(OP_CONST)
+		{
+			_stack.push_back(_program.constants[*pc++]);
+			DISPATCH();
+		}
+		TARGET(OP_INT)
+		{
+			_stack.push_back(Datum(*pc++));
+			DISPATCH();
+		}
+		TARGET(OP_LOAD_LOCAL)
+		{
+			push(locals[*pc++]);
+			DISPATCH();
+		}
+		TARGET(OP_LOAD_OUTER)
+		{
+			push(outer(pc[0])->slots[pc[1]]);
+			pc += 2;
+			DISPATCH();
+		}
+		TARGET(OP_LOAD_GLOBAL)
+		{
+			push(_globals[*pc++]);
+			DISPATCH();
+		}
+		TARGET(OP_STORE_LOCAL)
+		{
+			locals[*pc++] = pop();
+			DISPATCH();
+		}
+		TARGET(OP_STORE_OUTER)
+		{
+			if (_speculative)
+				throw SpeculationAbort();
+			outer(pc[0])->slots[pc[1]] = pop();
+			pc += 2;
+			DISPATCH();
+		}
+		TARGET(OP_STORE_GLOBAL)
+		{
+			if (_speculative)
+				throw SpeculationAbort();
+			_globals[*pc++] = pop();
+			DISPATCH();
+		}
+		TARGET(OP_ADD)
+		{
+			int right = getValue(pop());
+			Datum& left = _stack.back();
+			left = Datum(getValue(left) + right);
+			DISPATCH();
+		}
+		TARGET(OP_JUMP)
+		{
+			pc = code + *pc;
+			DISPATCH();
+		}
+		TARGET(OP_JUMP_NOT_GREATER)
+		{
+			int right = getValue(pop());
+			int left = getValue(pop());
+			if (left > right)
+				++pc;
+			else
+				pc = code + *pc;
+			DISPATCH();
+		}
+		TARGET(OP_POP)
+		{
+			_stack.pop_back();
+			DISPATCH();
+		}
+		TARGET(OP_CLOSURE)
+		{
+			Function* func = _program.functions[*pc++].get();
+			if (_heap.needsCollect())
+				collectGarbage();
+			_stack.push_back(_heap.newClosure(func, _current));
+			DISPATCH();
+		}
+		TARGET(OP_TAILCALL)
+		{
+			if (_current == nullptr)
+				_locals_top = _base;
+			if (profiled)
+				_profiler->leave();
+			goto enter_function;
+		}
+		TARGET(OP_CALL)
+		{
+			{
+				const Datum& callee = _stack[_stack.size() - 2];
+				const Datum& arg = _stack.back();
+				if (callee.kind == Datum::FUNCTION && callee.closure->function->memoize && arg.kind == Datum::INT)
+				{
+					MemoEntry& entry = memoEntry(callee.closure, arg.number);
+					if (entry.closure == callee.closure && entry.arg == arg.number)
+					{
+						_stack.pop_back();
+						_stack.back() = entry.result;
+						DISPATCH();
+					}
+					_memo_calls.push_back({ callee.closure, arg.number, _calls.size() + 1, _impure_calls });
+				}
+			}
+			_calls.push_back({ _current, _outer, static_cast<int>(pc - code), _base });
+		enter_function:
+			Datum callee = _stack[_stack.size() - 2];
+			if (callee.kind != Datum::FUNCTION)
+				throw "ERROR";
+			Function* func = callee.closure->function;
+			if (profiled)
+				_profiler->enter(func, _calls.size());
+			if (!func->deterministic)
+				++_impure_calls;
+			_outer = callee.closure->parent;
+			if (func->heap_frame)
+			{
+				if (_heap.needsCollect())
+					collectGarbage();
+				_current = _heap.newFrame(_outer, func->slots_amount);
+				locals = _current->slots.data();
+			}
+			else
+			{
+				_current = nullptr;
+				_base = _locals_top;
+				_locals_top += func->slots_amount;
+				if (_locals_top > _locals.size())
+					_locals.resize(max<size_t>(_locals_top, _locals.size() * 2));
+				locals = _locals.data() + _base;
+				for (int i = 1; i < func->slots_amount; ++i)
+					locals[i] = Datum();
+			}
+			locals[0] = pop();
+			_stack.pop_back();
+			pc = code + func->entry;
+			DISPATCH();
+		}
+		TARGET(OP_RETURN)
+		{
+			if (!_memo_calls.empty() && _memo_calls.back().depth == _calls.size())
+			{
+				MemoCall& memo = _memo_calls.back();
+				if (memo.impure_calls == _impure_calls && isPlainData(_stack.back()))
+					memoEntry(memo.closure, memo.arg) = { memo.closure, memo.arg, _stack.back() };
+				_memo_calls.pop_back();
+			}
+			if (profiled)
+				_profiler->leave();
+			if (_current == nullptr)
+				_locals_top = _base;
+			CallFrame &call = _calls.back();
+			pc = code + call.return_pc;
+			_current = call.current;
+			_outer = call.outer;
+			_base = call.base;
+			_calls.pop_back();
+			locals = _current != nullptr ? _current->slots.data() : _locals.data() + _base;
+			DISPATCH();
+		}
+		TARGET(OP_ARR)
+		{
+			size_t amount = *pc++;
+			ArrayObject* arr = newArray(amount);
+			for (auto element = _stack.end() - amount; element != _stack.end(); ++element)
+				arr->push(*element);
+			_stack.resize(_stack.size() - amount);
+			_stack.push_back(arr);
+			DISPATCH();
+		}
+		TARGET(OP_GEN_BEGIN)
+		{
+			int len = getValue(pop());
+			ArrayObject* arr = newArray(len > 0 ? len : 0);
+			Datum func = *pc++ ? pop() : Datum();
+			int index = 0;
+			if (parallelizable(func, len) && parallelGen(arr, func, len))
+				index = len;
+			_gens.push_back({ arr, func, index, len });
+			DISPATCH();
+		}
+		TARGET(OP_GEN_LOOP)
+		{
+			if (_gens.back().index < _gens.back().length)
+			{
+				++pc;
+				DISPATCH();
+			}
+			_stack.push_back(_gens.back().arr);
+			_gens.pop_back();
+			pc = code + *pc;
+			DISPATCH();
+		}
+		TARGET(OP_GEN_FUNC)
+		{
+			_stack.push_back(_gens.back().func);
+			DISPATCH();
+		}
+		TARGET(OP_GEN_INDEX)
+		{
+			_stack.push_back(Datum(_gens.back().index));
+			DISPATCH();
+		}
+		TARGET(OP_GEN_STORE)
+		{
+			_gens.back().arr->push(pop());
+			++_gens.back().index;
+			DISPATCH();
+		}
+		TARGET(OP_AT)
+		{
+			int id = getValue(pop());
+			Datum at_arr = pop();
+			if (at_arr.kind != Datum::ARRAY)
+			{
+				throw "ERROR";
+			}
+			if (id < 0 || id >= static_cast<int>(at_arr.array->size()))
+			{
+				throw "ERROR";
+			}
+			_stack.push_back(at_arr.array->at(id));
+			DISPATCH();
+		}
+		TARGET(OP_RECORD)
+		{
+			if (!_speculative && _records[*pc].kind == Datum::NONE)
+				_records[*pc] = _stack.back();
+			++pc;
+			DISPATCH();
+		}
+		TARGET(OP_HALT)
+		{
+			return pop();
+		}
+#ifndef DL_COMPUTED_GOTO
+			}
+		}
+#endif
+#undef TARGET
+#undef DISPATCH
+	}
+
+
+	bool parallelizable(const Datum& func, int len)
+	{
+		static const size_t threads = DL_GEN_THREADS > 0 ? DL_GEN_THREADS : thread::hardware_concurrency();
+		if (_speculative || !_parallel_gen || threads < 2 || len < 2 * parallel_gen_chunk)
+			return false;
+		if (func.kind != Datum::FUNCTION || !func.closure->function->pure)
+			return false;
+		if (!_pool)
+			_pool.reset(new WorkerPool(threads));
+		return true;
+	}
+
+
+	bool parallelGen(ArrayObject* arr, const Datum& func, int len)
+	{
+		size_t workers = min(_pool->size(), static_cast<size_t>(len / parallel_gen_chunk));
+		vector<unique_ptr<VM>> vms;
+		for (size_t i = 0; i < workers; ++i)
+			vms.emplace_back(new VM(_program, _globals, static_cast<unsigned short>(i + 1)));
+		vector<Outcome> outcomes(workers, DONE);
+		arr->box();
+		arr->elements.resize(len);
+		_pool->run(workers, [&](size_t i) {
+			int from = static_cast<int>(len * i / workers);
+			int to = static_cast<int>(len * (i + 1) / workers);
+			try
+			{
+				vms[i]->runChunk(func, arr, from, to);
+			}
+			catch (SpeculationAbort&)
+			{
+				outcomes[i] = ABORTED;
+			}
+			catch (...)
+			{
+				outcomes[i] = FAILED;
+			}
+		});
+		if (find(outcomes.begin(), outcomes.end(), ABORTED) != outcomes.end())
+		{
+			arr->clear();
+			return false;
+		}
+		if (find(outcomes.begin(), outcomes.end(), FAILED) != outcomes.end())
+			throw "ERROR";
+		for (auto& vm : vms)
+		{
+			_heap.adopt(vm->_heap);
+			_impure_calls += vm->_impure_calls;
+		}
+		arr->pack();
+		return true;
+	}
+
+
+	void runChunk(const Datum& func, ArrayObject* arr, int from, int to)
+	{
+		_gen_target = arr;
+		_gen_from = from;
+		for (_gen_done = from; _gen_done < to; ++_gen_done)
+		{
+			_stack.push_back(func);
+			_stack.push_back(Datum(_gen_done));
+			arr->elements[_gen_done] = execute<false>(_program.code.data() + _program.call_entry);
+		}
+	}
+
+
+	Datum pop()
+	{
+		Datum top = _stack.back();
+		_stack.pop_back();
+		return top;
+	}
+
+
+	void push(const Datum& var)
+	{
+		if (var.kind == Datum::NONE)
+			throw "ERROR";
+		_stack.push_back(var);
+	}
+
+
+	Frame* outer(int depth)
+	{
+		Frame* frame = _outer;
+		for (int i = 1; i < depth; ++i)
+			frame = frame->parent;
+		return frame;
+	}
+
+
+	ArrayObject* newArray(size_t capacity)
+	{
+		if (_heap.needsCollect())
+			collectGarbage();
+		return _heap.newArray(capacity);
+	}
+
+
+	void collectGarbage()
+	{
+		for (auto& datum : _globals)
+			_heap.mark(datum);
+		for (auto& datum : _stack)
+			_heap.mark(datum);
+		for (size_t i = 0; i < _locals_top; ++i)
+			_heap.mark(_locals[i]);
+		for (auto& call : _calls)
+		{
+			_heap.mark(call.current);
+			_heap.mark(call.outer);
+		}
+		for (auto& gen : _gens)
+		{
+			_heap.mark(gen.arr);
+			_heap.mark(gen.func);
+		}
+		if (_gen_target != nullptr)
+		{
+			for (int i = _gen_from; i < _gen_done; ++i)
+				_heap.mark(_gen_target->elements[i]);
+		}
+		for (auto& entry : _memo)
+		{
+			_heap.mark(entry.closure);
+			_heap.mark(entry.result);
+		}
+		for (auto& memo : _memo_calls)
+			_heap.mark(memo.closure);
+		for (auto& record : _records)
+			_heap.mark(record);
+		_heap.mark(_current);
+		_heap.mark(_outer);
+		_heap.collect();
+	}
+
+
+	static bool isPlainData(const Datum& datum)
+	{
+		return datum.kind == Datum::INT || (datum.kind == Datum::ARRAY && datum.array->packed);
+	}
+
+
+	MemoEntry& memoEntry(Closure* closure, int arg)
+	{
+		if (_memo.empty())
+			_memo.resize(memo_capacity, { nullptr, 0, Datum() });
+		uint64_t key = reinterpret_cast<uintptr_t>(closure) ^ (static_cast<uint64_t>(static_cast<unsigned>(arg)) << 32);
+		key ^= key >> 33;
+		key *= 0xff51afd7ed558ccdULL;
+		key ^= key >> 33;
+		return _memo[key & (memo_capacity - 1)];
+	}
+};
+
+
+
+struct Token
+{
+	enum Kind : unsigned char
+	{
+		OPEN,
+		CLOSE,
+		WORD,
+		END
+	};
+
+	Kind kind;
+	Keyword keyword;
+	string_view text;
+};
+
+
+class Lexer
+{
+public:
+	Lexer(string_view source) : _source(source) {}
+
+
+	Token next()
+	{
+		while (_pos < _source.size() && isspace(static_cast<unsigned char>(_source[_pos])))
+			++_pos;
+		if (_pos == _source.size())
+			return { Token::END, KW_NONE, {} };
+		char c = _source[_pos];
+		if (c == '(' || c == ')')
+			return { c == '(' ? Token::OPEN : Token::CLOSE, KW_NONE, _source.substr(_pos++, 1) };
+		size_t start = _pos;
+		while (_pos < _source.size() && !isDelimiter(_source[_pos]))
+			++_pos;
+		string_view text = _source.substr(start, _pos - start);
+		return { Token::WORD, keyword(text), text };
+	}
+private:
+	string_view _source;
+	size_t _pos = 0;
+
+
+	static bool isDelimiter(char c)
+	{
+		return c == '(' || c == ')' || isspace(static_cast<unsigned char>(c));
+	}
+
+
+	static Keyword keyword(string_view text)
+	{
+		static const unordered_map<string_view, Keyword> keywords = {
+			{ "val", KW_VAL }, { "var", KW_VAR }, { "add", KW_ADD }, { "if", KW_IF },
+			{ "then", KW_THEN }, { "else", KW_ELSE }, { "let", KW_LET }, { "in", KW_IN },
+			{ "function", KW_FUNCTION }, { "call", KW_CALL }, { "set", KW_SET }, { "block", KW_BLOCK },
+			{ "arr", KW_ARR }, { "gen", KW_GEN }, { "at", KW_AT }, { "=", KW_ASSIGN }
+		};
+		auto search = keywords.find(text);
+		return search != keywords.end() ? search->second : KW_NONE;
+	}
+};
+
+
+const size_t max_nesting_depth = 10000;
+
+
+class Parser
+{
+public:
+	Parser(string_view source, Ast& ast) : _source(source), _lexer(source), _ast(ast)
+	{
+		advance();
+	}
+
+
+	int parseProgram()
+	{
+		return parseExpression();
+	}
+private:
+	string_view _source;
+	Lexer _lexer;
+	Ast& _ast;
+	Token _token;
+	size_t _depth = 0;
+
+
+	void advance()
+	{
+		_token = _lexer.next();
+	}
+
+
+	void expect(Token::Kind kind)
+	{
+		if (_token.kind != kind)
+			throw "ERROR";
+		advance();
+	}
+
+
+	void expect(Keyword keyword)
+	{
+		if (_token.kind != Token::WORD || _token.keyword != keyword)
+			throw "ERROR";
+		advance();
+	}
+
+
+	string_view word()
+	{
+		if (_token.kind != Token::WORD)
+			throw "ERROR";
+		string_view text = _token.text;
+		advance();
+		return text;
+	}
+
+
+	int number()
+	{
+		string_view text = word();
+		const char* first = text.data() + (!text.empty() && text[0] == '+');
+		int result = 0;
+		if (from_chars(first, text.data() + text.size(), result).ec != errc())
+			throw "ERROR";
+		return result;
+	}
+
+
+	vector<int> parseList()
+	{
+		vector<int> expr;
+		while (_token.kind == Token::OPEN)
+			expr.push_back(parseExpression());
+		return expr;
+	}
+
+
+	int parseExpression()
+	{
+		if (++_depth > max_nesting_depth)
+			throw "ERROR";
+		size_t offset = _token.kind == Token::OPEN ? _token.text.data() - _source.data() : 0;
+		expect(Token::OPEN);
+		if (_token.kind != Token::WORD)
+			throw "ERROR";
+		Keyword keyword = _token.keyword;
+		advance();
+
+		int res_exp = -1;
+		switch (keyword)
+		{
+		case KW_VAL:
+			res_exp = _ast.make(KW_VAL, number(), {}, offset);
+			break;
+		case KW_VAR:
+			res_exp = _ast.make(KW_VAR, _ast.intern(word()), {}, offset);
+			break;
+		case KW_ADD:
+		case KW_CALL:
+		case KW_GEN:
+		case KW_AT:
+		{
+			int e1 = parseExpression();
+			int e2 = parseExpression();
+			res_exp = _ast.make(keyword, 0, { e1, e2 }, offset);
+			break;
+		}
+		case KW_LET:
+		{
+			int id = _ast.intern(word());
+			expect(KW_ASSIGN);
+			int e1 = parseExpression();
+			expect(KW_IN);
+			int e2 = parseExpression();
+			res_exp = _ast.make(KW_LET, id, { e1, e2 }, offset);
+			break;
+		}
+		case KW_IF:
+		{
+			int e1 = parseExpression();
+			int e2 = parseExpression();
+			expect(KW_THEN);
+			int e_then = parseExpression();
+			expect(KW_ELSE);
+			int e_else = parseExpression();
+			res_exp = _ast.make(KW_IF, 0, { e1, e2, e_then, e_else }, offset);
+			break;
+		}
+		case KW_FUNCTION:
+		case KW_SET:
+		{
+			int id = _ast.intern(word());
+			int exp = parseExpression();
+			res_exp = _ast.make(keyword, id, { exp, exp }, offset);
+			break;
+		}
+		case KW_BLOCK:
+		case KW_ARR:
+		{
+			vector<int> expr = parseList();
+			res_exp = _ast.make(keyword, 0, expr, offset);
+			break;
+		}
+		default:
+			throw "ERROR";
+		}
+		expect(Token::CLOSE);
+		--_depth;
+		return res_exp;
+	}
+};
+
+
+string readSource(ifstream& in)
+{
+	string source;
+	in.seekg(0, ios::end);
+	streamoff size = in.tellg();
+	if (size > 0)
+	{
+		source.resize(static_cast<size_t>(size));
+		in.seekg(0, ios::beg);
+		in.read(&source[0], size);
+		source.resize(static_cast<size_t>(in.gcount()));
+	}
+	return source;
+}
+
+
+class AstReader
+{
+public:
+	AstReader(string_view bytes, Ast& ast) : _bytes(bytes), _ast(ast) {}
+
+
+	int readProgram()
+	{
+		int exp = readExpression();
+		if (_pos != _bytes.size())
+			throw "ERROR";
+		return exp;
+	}
+
+
+	uint64_t number()
+	{
+		uint64_t value = 0;
+		for (int shift = 0; shift < 64; shift += 7)
+		{
+			unsigned char byte = next();
+			value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+			if (byte < 0x80)
+				return value;
+		}
+		throw "ERROR";
+	}
+
+
+	string_view text()
+	{
+		uint64_t length = number();
+		if (length > _bytes.size() - _pos)
+			throw "ERROR";
+		string_view value = _bytes.substr(_pos, length);
+		_pos += length;
+		return value;
+	}
+private:
+	string_view _bytes;
+	Ast& _ast;
+	size_t _pos = 0;
+	size_t _depth = 0;
+
+
+	unsigned char next()
+	{
+		if (_pos == _bytes.size())
+			throw "ERROR";
+		return static_cast<unsigned char>(_bytes[_pos++]);
+	}
+
+
+	int integer()
+	{
+		uint32_t bits = static_cast<uint32_t>(number());
+		return static_cast<int>((bits >> 1) ^ (0u - (bits & 1)));
+	}
+
+
+	int name()
+	{
+		return _ast.intern(text());
+	}
+
+
+	vector<int> readList()
+	{
+		uint64_t amount = number();
+		if (amount > _bytes.size() - _pos)
+			throw "ERROR";
+		vector<int> expr;
+		for (uint64_t i = 0; i < amount; ++i)
+			expr.push_back(readExpression());
+		return expr;
+	}
+
+
+	int readExpression()
+	{
+		if (++_depth > max_nesting_depth)
+			throw "ERROR";
+		int exp = readNode();
+		--_depth;
+		return exp;
+	}
+
+
+	int readNode()
+	{
+		Keyword keyword = static_cast<Keyword>(next());
+		switch (keyword)
+		{
+		case KW_VAL:
+			return _ast.make(KW_VAL, integer(), {});
+		case KW_VAR:
+			return _ast.make(KW_VAR, name(), {});
+		case KW_ADD:
+		case KW_CALL:
+		case KW_GEN:
+		case KW_AT:
+		{
+			int e1 = readExpression();
+			int e2 = readExpression();
+			return _ast.make(keyword, 0, { e1, e2 });
+		}
+		case KW_LET:
+		{
+			int id = name();
+			int e1 = readExpression();
+			int e2 = readExpression();
+			return _ast.make(KW_LET, id, { e1, e2 });
 		}
+		case KW_IF:
+		{
+			int e1 = readExpression();
+			int e2 = readExpression();
+			int e_then = readExpression();
+			int e_else = readExpression();
+			return _ast.make(KW_IF, 0, { e1, e2, e_then, e_else });
+		}
+		case KW_FUNCTION:
+		case KW_SET:
+		{
+			int id = name();
+			int exp = readExpression();
+			return _ast.make(keyword, id, { exp, exp });
+		}
+		case KW_BLOCK:
+		case KW_ARR:
+		{
+			vector<int> expr = readList();
+			return _ast.make(keyword, 0, expr);
+		}
+		default:
+			throw "ERROR";
+		}
+	}
+};
+
+
+struct CompiledScript
+{
+	Ast ast;
+	Program program;
+};
+
+
+class ScriptCache
+{
+public:
+	ScriptCache(string directory, size_t capacity) : _directory(move(directory)), _capacity(capacity) {}
+
+
+	shared_ptr<const CompiledScript> get(string_view source)
+	{
+		uint64_t hash = hashSource(source);
+		{
+			lock_guard<mutex> lock(_mutex);
+			auto search = _entries.find(hash);
+			if (search != _entries.end() && search->second.source == source)
+				return check(search->second.script);
+		}
+		shared_ptr<const CompiledScript> script = build(source, hash);
+		if (_capacity > 0)
+		{
+			lock_guard<mutex> lock(_mutex);
+			if (_entries.count(hash) == 0)
+			{
+				if (_order.size() == _capacity)
+				{
+					_entries.erase(_order.front());
+					_order.pop_front();
+				}
+				_order.push_back(hash);
+			}
+			_entries[hash] = { string(source), script };
+		}
+		return check(script);
+	}
+private:
+	struct Entry
+	{
+		string source;
+		shared_ptr<const CompiledScript> script;
+	};
+
+	static constexpr uint64_t ast_format = 2;
+
+	string _directory;
+	size_t _capacity;
+	mutex _mutex;
+	unordered_map<uint64_t, Entry> _entries;
+	deque<uint64_t> _order;
+
+
+	static uint64_t hashSource(string_view source)
+	{
+		uint64_t hash = 14695981039346656037ull;
+		for (char c : source)
+		{
+			hash ^= static_cast<unsigned char>(c);
+			hash *= 1099511628211ull;
+		}
+		return hash;
+	}
+
+
+	static shared_ptr<const CompiledScript> check(shared_ptr<const CompiledScript> script)
+	{
+		if (script == nullptr)
+			throw "ERROR";
+		return script;
+	}
+
+
+	shared_ptr<const CompiledScript> build(string_view source, uint64_t hash)
+	{
+		shared_ptr<CompiledScript> script = make_shared<CompiledScript>();
+		try
+		{
+			int root = load(source, hash, script->ast);
+			root = Optimizer(script->ast).optimizeProgram(root);
+			script->program = Compiler(script->ast).compileProgram(root);
+		}
+		catch (...)
+		{
+			return nullptr;
+		}
+		return script;
+	}
+
+
+	int load(string_view source, uint64_t hash, Ast& ast)
+	{
+		if (_directory.empty())
+			return Parser(source, ast).parseProgram();
+		char name[16];
+		string path = _directory + "/" + string(name, to_chars(name, name + sizeof(name), hash, 16).ptr) + ".dlast";
+		ifstream in(path, ios::binary);
+		if (in.is_open())
+		{
+			string bytes = readSource(in);
+			try
+			{
+				AstReader reader(bytes, ast);
+				if (reader.number() == ast_format && reader.number() == hash && reader.text() == source)
+					return reader.readProgram();
+			}
+			catch (...)
+			{}
+		}
+		int root = Parser(source, ast).parseProgram();
+		AstWriter writer(ast);
+		writer.number(ast_format);
+		writer.number(hash);
+		writer.text(source);
+		writer.write(root);
+		store(path, writer.bytes());
+		return root;
+	}
+
+
+	static void store(const string& path, const string& bytes)
+	{
+		string temp = path + "." + to_string(std::hash<thread::id>()(this_thread::get_id())) + ".tmp";
+		ofstream out(temp, ios::binary);
+		out.write(bytes.data(), bytes.size());
+		out.close();
+		if (!out || rename(temp.c_str(), path.c_str()) != 0)
+			remove(temp.c_str());
+	}
+};
+
+
+string cacheDirectory()
+{
+	const char* directory = getenv("DL_CACHE_DIR");
+	return directory != nullptr ? directory : "";
+}
+
+
+string evaluate(string_view source, ScriptCache& cache, bool parallel_gen)
+{
+	try
+	{
+		shared_ptr<const CompiledScript> script = cache.get(source);
+		VM vm(script->program, parallel_gen);
+		return vm.run().getString();
+	}
+	catch (...)
+	{
+		return "ERROR";
 	}
+}
+
+
+const size_t max_frame_size = 1 << 28;
+
 
-	throw "ERROR";
+bool readFrame(istream& in, string& source)
+{
+	size_t length;
+	if (!(in >> length) || in.get() != '\n' || length > max_frame_size)
+		return false;
+	source.resize(length);
+	return static_cast<bool>(in.read(&source[0], length));
 }
 
 
-int main()
+void writeFrame(ostream& out, const string& result)
 {
-	ifstream in;
-	in.open("input.txt");
-	ofstream out;
-	out.open("output.txt");
-	list <string> tokens;
-	tokenizer(in, tokens);
-	Expression* exp = parser(tokens);
-	unordered_map<string, Expression*> env;
+	out << result.size() << '\n' << result << '\n';
+}
+
+
+class ScriptServer
+{
+public:
+	ScriptServer(size_t threads, ScriptCache& cache) : _threads(max<size_t>(threads, 1)), _cache(cache) {}
+
+
+	size_t serve(istream& in, ostream& out)
+	{
+		ostream* tied = in.tie(nullptr);
+		vector<thread> workers;
+		for (size_t i = 0; i < _threads; ++i)
+			workers.emplace_back([this] { work(); });
+		thread writer([this, &out] { write(out); });
+
+		string source;
+		while (readFrame(in, source))
+		{
+			unique_lock<mutex> lock(_mutex);
+			_has_room.wait(lock, [this] { return _read - _written < max_in_flight; });
+			_jobs.push_back({ _read++, move(source) });
+			_has_job.notify_one();
+		}
+		{
+			lock_guard<mutex> lock(_mutex);
+			_closed = true;
+		}
+		_has_job.notify_all();
+		_has_result.notify_all();
+		for (auto& worker : workers)
+			worker.join();
+		writer.join();
+		in.tie(tied);
+		return _read;
+	}
+private:
+	struct Job
+	{
+		size_t id;
+		string source;
+	};
+
+	static constexpr size_t max_in_flight = 1024;
+
+	size_t _threads;
+	ScriptCache& _cache;
+	mutex _mutex;
+	condition_variable _has_job;
+	condition_variable _has_result;
+	condition_variable _has_room;
+	deque<Job> _jobs;
+	unordered_map<size_t, string> _results;
+	size_t _read = 0;
+	size_t _written = 0;
+	bool _closed = false;
+
+
+	void work()
+	{
+		for (;;)
+		{
+			Job job;
+			{
+				unique_lock<mutex> lock(_mutex);
+				_has_job.wait(lock, [this] { return _closed || !_jobs.empty(); });
+				if (_jobs.empty())
+					return;
+				job = move(_jobs.front());
+				_jobs.pop_front();
+			}
+			string result = evaluate(job.source, _cache, false);
+			lock_guard<mutex> lock(_mutex);
+			_results[job.id] = move(result);
+			_has_result.notify_all();
+		}
+	}
+
+
+	void write(ostream& out)
+	{
+		for (;;)
+		{
+			string result;
+			{
+				unique_lock<mutex> lock(_mutex);
+				_has_result.wait(lock, [this] { return _results.count(_written) != 0 || (_closed && _written == _read); });
+				auto search = _results.find(_written);
+				if (search == _results.end())
+					return;
+				result = move(search->second);
+				_results.erase(search);
+			}
+			writeFrame(out, result);
+			bool drained;
+			{
+				lock_guard<mutex> lock(_mutex);
+				++_written;
+				drained = _results.count(_written) == 0;
+			}
+			if (drained)
+				out.flush();
+			_has_room.notify_one();
+		}
+	}
+};
+
+
+const size_t server_cache_capacity = 4096;
+
+
+int serveMain(int argc, char *argv[])
+{
+	size_t threads = argc > 2 ? stoul(argv[2]) : thread::hardware_concurrency();
+	ios::sync_with_stdio(false);
+	ScriptCache cache(cacheDirectory(), server_cache_capacity);
+	auto start = chrono::steady_clock::now();
+	size_t served = ScriptServer(threads, cache).serve(cin, cout);
+	chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+	cerr << "served " << served << " scripts in " << elapsed.count() << " s ("
+		<< served / max(elapsed.count(), 1e-9) << " scripts/s)\n";
+	return 0;
+}
+
+
+class IncrementalSession
+{
+public:
+	string evaluate(string_view source)
+	{
+		_reused = 0;
+		_probes.clear();
+		Ast ast;
+		try
+		{
+			int root = Parser(source, ast).parseProgram();
+			root = Optimizer(ast).optimizeProgram(root);
+			_infos.assign(ast.size(), {});
+			_assigned.assign(ast.namesAmount(), false);
+			_binders.assign(ast.namesAmount(), {});
+			ast.collectAssigned(root, _assigned);
+			analyze(ast, root, 0);
+			root = reuse(ast, root);
+			Program program = Compiler(ast).compileProgram(root);
+			VM vm(program);
+			string result;
+			try
+			{
+				result = vm.run().getString();
+			}
+			catch (...)
+			{
+				result = "ERROR";
+			}
+			harvest(vm.records());
+			return result;
+		}
+		catch (...)
+		{
+			return "ERROR";
+		}
+	}
+
+
+	size_t reused() const
+	{
+		return _reused;
+	}
+private:
+	struct NodeInfo
+	{
+		uint64_t hash = 0;
+		int min_unstable = INT_MAX;
+		int min_self = INT_MAX;
+		bool expensive = false;
+		bool candidate = false;
+	};
+
+	struct Binder
+	{
+		int depth;
+		bool stable;
+		bool defining;
+		NodeInfo definition;
+	};
+
+	struct Entry
+	{
+		Datum value;
+		unique_ptr<ArrayObject> array;
+	};
+
+	static constexpr size_t capacity = 1 << 16;
+
+	vector<NodeInfo> _infos;
+	vector<bool> _assigned;
+	vector<vector<Binder>> _binders;
+	vector<uint64_t> _probes;
+	unordered_map<uint64_t, Entry> _entries;
+	deque<uint64_t> _order;
+	size_t _reused = 0;
+
+
+	static uint64_t mix(uint64_t hash, uint64_t value)
+	{
+		hash = (hash ^ value) * 0xff51afd7ed558ccdull;
+		return hash ^ (hash >> 33);
+	}
+
+
+	static uint64_t mixName(uint64_t hash, const Ast& ast, int id)
+	{
+		return mix(hash, std::hash<string_view>()(ast.name(id)));
+	}
+
+
+	static void merge(NodeInfo& info, const NodeInfo& part)
+	{
+		info.hash = mix(info.hash, part.hash);
+		info.min_unstable = min(info.min_unstable, part.min_unstable);
+		info.min_self = min(info.min_self, part.min_self);
+		info.expensive = info.expensive || part.expensive;
+	}
+
+
+	void use(NodeInfo& info, int id)
+	{
+		if (_binders[id].empty())
+		{
+			info.min_unstable = -1;
+			return;
+		}
+		const Binder& binder = _binders[id].back();
+		if (!binder.stable)
+			info.min_unstable = min(info.min_unstable, binder.depth);
+		else if (binder.defining)
+			info.min_self = min(info.min_self, binder.depth);
+		else
+		{
+			info.hash = mix(info.hash, binder.definition.hash);
+			info.min_unstable = min(info.min_unstable, binder.definition.min_unstable);
+			info.min_self = min(info.min_self, binder.definition.min_self);
+		}
+	}
+
+
+	NodeInfo analyze(const Ast& ast, int node, int depth)
+	{
+		const AstNode& n = ast[node];
+		NodeInfo info;
+		info.hash = mix(0, n.kind);
+		switch (n.kind)
+		{
+		case KW_VAL:
+			info.hash = mix(info.hash, static_cast<uint32_t>(n.value));
+			break;
+		case KW_VAR:
+			info.hash = mixName(info.hash, ast, n.value);
+			use(info, n.value);
+			break;
+		case KW_LET:
+		{
+			info.hash = mixName(info.hash, ast, n.value);
+			_binders[n.value].push_back({ depth + 1, !_assigned[n.value], true, {} });
+			NodeInfo definition = analyze(ast, ast.child(node, 0), depth + 1);
+			Binder& binder = _binders[n.value].back();
+			binder.defining = false;
+			binder.definition = definition;
+			if (definition.min_self >= depth + 1)
+				binder.definition.min_self = INT_MAX;
+			merge(info, definition);
+			merge(info, analyze(ast, ast.child(node, 1), depth + 1));
+			_binders[n.value].pop_back();
+			break;
+		}
+		case KW_FUNCTION:
+			info.hash = mixName(info.hash, ast, n.value);
+			_binders[n.value].push_back({ depth + 1, false, false, {} });
+			merge(info, analyze(ast, ast.child(node, 1), depth + 1));
+			_binders[n.value].pop_back();
+			info.expensive = false;
+			break;
+		case KW_SET:
+			info.hash = mixName(info.hash, ast, n.value);
+			merge(info, analyze(ast, ast.child(node, 1), depth));
+			info.min_unstable = min(info.min_unstable, _binders[n.value].empty() ? -1 : _binders[n.value].back().depth);
+			break;
+		default:
+			for (size_t i = 0; i < n.count; ++i)
+				merge(info, analyze(ast, ast.child(node, i), depth));
+			info.expensive = info.expensive || n.kind == KW_CALL || n.kind == KW_GEN;
+			break;
+		}
+		info.candidate = info.expensive && n.kind != KW_FUNCTION && info.min_unstable > depth && info.min_self > depth;
+		_infos[node] = info;
+		if (info.min_unstable > depth)
+			info.min_unstable = INT_MAX;
+		if (info.min_self > depth)
+			info.min_self = INT_MAX;
+		return info;
+	}
+
+
+	int reuse(Ast& ast, int node)
+	{
+		AstNode n = ast[node];
+		const NodeInfo& info = _infos[node];
+		if (info.candidate)
+		{
+			auto search = _entries.find(info.hash);
+			if (search != _entries.end())
+			{
+				++_reused;
+				const Datum& value = search->second.value;
+				if (value.kind == Datum::INT)
+					return ast.make(KW_VAL, value.number, {}, n.offset);
+				return ast.constant(value, n.offset);
+			}
+		}
+		if (n.kind == KW_FUNCTION || n.kind == KW_SET)
+			ast.setChild(node, 1, reuse(ast, ast.child(node, 1)));
+		else
+		{
+			vector<int> children;
+			for (size_t i = 0; i < n.count; ++i)
+				children.push_back(reuse(ast, ast.child(node, i)));
+			node = ast.rebuild(node, children);
+		}
+		if (!info.candidate)
+			return node;
+		_probes.push_back(info.hash);
+		return ast.make(KW_RECORD, static_cast<int>(_probes.size() - 1), { node }, n.offset);
+	}
+
+
+	void harvest(const vector<Datum>& records)
+	{
+		for (size_t i = 0; i < records.size(); ++i)
+		{
+			const Datum& record = records[i];
+			if (_entries.count(_probes[i]) != 0)
+				continue;
+			Entry entry;
+			if (record.kind == Datum::INT)
+				entry.value = record;
+			else if (record.kind == Datum::ARRAY && record.array->packed)
+			{
+				entry.array.reset(new ArrayObject);
+				entry.array->numbers = record.array->numbers;
+				entry.array->marked = true;
+				entry.value = entry.array.get();
+			}
+			else
+				continue;
+			if (_order.size() == capacity)
+			{
+				_entries.erase(_order.front());
+				_order.pop_front();
+			}
+			_order.push_back(_probes[i]);
+			_entries[_probes[i]] = move(entry);
+		}
+	}
+};
+
+
+int incrementalMain()
+{
+	ios::sync_with_stdio(false);
+	IncrementalSession session;
+	string source;
+	while (readFrame(cin, source))
+	{
+		auto start = chrono::steady_clock::now();
+		string result = session.evaluate(source);
+		double elapsed = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+		writeFrame(cout, result);
+		cout.flush();
+		cerr << "evaluated in " << elapsed << " ms, reused " << session.reused() << " cached subtrees\n";
+	}
+	return 0;
+}
+
+
+double benchRun(const Program &program, int repeat, string& result)
+{
+	double best = 0;
+	for (int i = 0; i < repeat; ++i)
+	{
+		auto start = chrono::steady_clock::now();
+		try
+		{
+			VM vm(program);
+			result = vm.run().getString();
+		}
+		catch (...)
+		{
+			result = "ERROR";
+		}
+		double elapsed = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+		if (i == 0 || elapsed < best)
+			best = elapsed;
+	}
+	return best;
+}
+
+
+int benchMain(int argc, char *argv[])
+{
+	if (argc < 3)
+	{
+		cerr << "usage: " << argv[0] << " bench script.dl...\n";
+		return 1;
+	}
+	const int repeat = 5;
+	for (int i = 2; i < argc; ++i)
+	{
+		ifstream in(argv[i], ios::binary);
+		string source = readSource(in);
+		Ast ast;
+		try
+		{
+			int root = Parser(source, ast).parseProgram();
+			Program plain = Compiler(ast).compileProgram(root);
+			string plain_result;
+			double plain_time = benchRun(plain, repeat, plain_result);
+
+			auto start = chrono::steady_clock::now();
+			int optimized_root = Optimizer(ast).optimizeProgram(root);
+			double optimize_time = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+			Program optimized = Compiler(ast).compileProgram(optimized_root);
+			string optimized_result;
+			double optimized_time = benchRun(optimized, repeat, optimized_result);
+
+			cout << argv[i] << ": code " << plain.code.size() << " -> " << optimized.code.size() << " words"
+				<< ", run " << plain_time << " -> " << optimized_time << " ms"
+				<< ", optimize " << optimize_time << " ms"
+				<< (plain_result == optimized_result ? "" : ", RESULT MISMATCH") << "\n";
+		}
+		catch (...)
+		{
+			cout << argv[i] << ": ERROR\n";
+		}
+	}
+	return 0;
+}
+
+
+int profileMain(int argc, char *argv[])
+{
+	if (argc < 3)
+	{
+		cerr << "usage: " << argv[0] << " profile script.dl [stacks.folded]\n";
+		return 1;
+	}
+	ifstream in(argv[2], ios::binary);
+	string source = readSource(in);
+	Ast ast;
 	try
 	{
-		out << exp->eval(env)->getString();
+		int root = Parser(source, ast).parseProgram();
+		root = Optimizer(ast).optimizeProgram(root);
+		Program program = Compiler(ast, true).compileProgram(root);
+		Profiler profiler(program);
+		string result;
+		try
+		{
+			VM vm(program, false, &profiler);
+			result = vm.run().getString();
+		}
+		catch (...)
+		{
+			result = "ERROR";
+		}
+		cout << "result " << result << "\n";
+		profiler.report(cout, source);
+		if (argc > 3)
+		{
+			ofstream folded(argv[3]);
+			profiler.writeFolded(folded, source);
+		}
 	}
 	catch (...)
 	{
-		out << "ERROR";
+		cout << argv[2] << ": ERROR\n";
+		return 1;
+	}
+	return 0;
+}
+
+
+int testMain()
+{
+	const pair<const char*, const char*> checks[] = {
+		{ "(let h = (function q (val 0)) in (let f = (function n (block (call (var h) (val 0)) (call (var h) (val 0)) "
+			"(function z (block (set n (add (var n) (val 1))) (var n))))) in (let a = (call (var f) (val 10)) in "
+			"(let b = (call (var f) (val 10)) in (arr (call (var a) (val 0)) (call (var a) (val 0)) (call (var b) (val 0)))))))",
+			"(arr (val 11) (val 12) (val 11) )" },
+	};
+	ScriptCache cache("", 0);
+	int failed = 0;
+	for (auto& check : checks)
+	{
+		string result = evaluate(check.first, cache, true);
+		if (result != check.second)
+		{
+			cout << "FAILED: " << check.first << "\n  expected " << check.second << "\n  got " << result << "\n";
+			++failed;
+		}
+	}
+
+	const size_t nested_arrays = 1000000;
+	string nested = evaluate("(let f = (function n (if (var n) (val 0) then (arr (call (var f) (add (var n) (val -1)))) else (val 0))) in "
+		"(call (var f) (val " + to_string(nested_arrays) + ")))", cache, true);
+	string expected_nested;
+	for (size_t i = 0; i < nested_arrays; ++i)
+		expected_nested += "(arr ";
+	expected_nested += "(val 0) ";
+	for (size_t i = 1; i < nested_arrays; ++i)
+		expected_nested += ") ";
+	expected_nested += ")";
+	if (nested != expected_nested)
+	{
+		cout << "FAILED: printing a deeply nested array\n";
+		++failed;
 	}
-	delete exp;
-	while (!bad_ptr.empty())
+
+	string deep;
+	for (size_t i = 0; i <= max_nesting_depth; ++i)
+		deep += "(add (val 1) ";
+	deep += "(val 0)" + string(max_nesting_depth + 1, ')');
+	stringstream frames;
+	stringstream answers;
+	for (const string& source : { string("(val 1)"), deep, string("(add (val 2) (val 3))") })
+		writeFrame(frames, source);
+	ScriptServer(2, cache).serve(frames, answers);
+	stringstream expected;
+	for (const string& result : { string("(val 1)"), string("ERROR"), string("(val 5)") })
+		writeFrame(expected, result);
+	if (answers.str() != expected.str())
 	{
-		Expression* tmp = bad_ptr.top();
-		bad_ptr.pop();
-		delete tmp;
+		cout << "FAILED: serve answers every frame after a too deeply nested one\n  got " << answers.str() << "\n";
+		++failed;
 	}
+	cout << (failed == 0 ? "all checks passed" : "checks failed") << "\n";
+	return failed == 0 ? 0 : 1;
+}
+
+
+int main(int argc, char *argv[])
+{
+	if (argc > 1 && string(argv[1]) == "bench")
+		return benchMain(argc, argv);
+	if (argc > 1 && string(argv[1]) == "serve")
+		return serveMain(argc, argv);
+	if (argc > 1 && string(argv[1]) == "profile")
+		return profileMain(argc, argv);
+	if (argc > 1 && string(argv[1]) == "incremental")
+		return incrementalMain();
+	if (argc > 1 && string(argv[1]) == "test")
+		return testMain();
+	ifstream in;
+	in.open("input.txt", ios::binary);
+	ofstream out;
+	out.open("output.txt");
+	ScriptCache cache(cacheDirectory(), 0);
+	out << evaluate(readSource(in), cache, true);
 	in.close();
 	out.close();
 }
\ No newline at end of file
@@ -1,13 +1,206 @@
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <functional>
 #include <iostream>
-#include <set>
+#include <memory>
+#include <mutex>
+#include <random>
 #include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef HASHMAP_STATS
+#define HASHMAP_STAT(...) __VA_ARGS__
+#else
+#define HASHMAP_STAT(...)
+#endif
+
 using namespace std;
 
+template <typename K, typename V>
+class HashTable;
+
 template <typename K, typename V>
 class HashMap;
 
+template <typename K>
+class HashSet;
+
+template <typename K>
+struct KeyHash
+{
+	size_t operator()(const K& key) const
+	{
+		uint64_t hash_value = hash<K>()(key);
+		hash_value ^= hash_value >> 33;
+		hash_value *= 0xff51afd7ed558ccdull;
+		hash_value ^= hash_value >> 33;
+		hash_value *= 0xc4ceb9fe1a85ec53ull;
+		hash_value ^= hash_value >> 33;
+		return static_cast<size_t>(hash_value);
+	}
+};
+
+
+template <>
+struct KeyHash<string>
+{
+	size_t operator()(string_view key) const
+	{
+		return hash<string_view>()(key);
+	}
+};
+
+
+const uint64_t key_hash_version = 2;
+
+
+template <typename V>
+struct ValueSize
+{
+	static const uint32_t value = sizeof(V);
+};
+
+
+template <>
+struct ValueSize<void>
+{
+	static const uint32_t value = 0;
+};
+
+
+class HyperLogLog
+{
+public:
+	static constexpr unsigned char min_precision = 4;
+	static constexpr unsigned char max_precision = 18;
+
+	HyperLogLog(unsigned char precision) : precision(precision), registers(size_t(1) << precision, 0)
+	{
+		assert(precision >= min_precision && precision <= max_precision);
+	}
+
+
+	void add(uint64_t hash_value)
+	{
+		hash_value += 0x9e3779b97f4a7c15ull;
+		hash_value = (hash_value ^ (hash_value >> 30)) * 0xbf58476d1ce4e5b9ull;
+		hash_value = (hash_value ^ (hash_value >> 27)) * 0x94d049bb133111ebull;
+		hash_value ^= hash_value >> 31;
+		size_t index = hash_value >> (64 - precision);
+		uint64_t rest = (hash_value << precision) | (uint64_t(1) << (precision - 1));
+		unsigned char rank = 1;
+		while (!(rest & (uint64_t(1) << 63)))
+		{
+			rest <<= 1;
+			++rank;
+		}
+		if (registers[index] < rank)
+			registers[index] = rank;
+	}
+
+
+	size_t estimate() const
+	{
+		double m = static_cast<double>(registers.size());
+		double sum = 0;
+		size_t zeros = 0;
+		for (unsigned char r : registers)
+		{
+			sum += ldexp(1.0, -r);
+			if (r == 0)
+				++zeros;
+		}
+		double result = 0.7213 / (1 + 1.079 / m) * m * m / sum;
+		if (result <= 2.5 * m && zeros != 0)
+			result = m * log(m / zeros);
+		return static_cast<size_t>(result + 0.5);
+	}
+
+
+	size_t get_memory_usage() const
+	{
+		return registers.size();
+	}
+
+private:
+	unsigned char precision;
+	vector<unsigned char> registers;
+};
+
+
+struct SnapshotHeader
+{
+	char magic[8];
+	uint32_t key_size;
+	uint32_t value_size;
+	uint32_t slot_size;
+	float overflow_koef;
+	float tombstone_koef;
+	uint64_t block_size;
+	uint64_t size;
+	uint64_t size_non_null;
+	uint64_t hash_id;
+};
+
+
+const size_t snapshot_offset = 64;
+static_assert(sizeof(SnapshotHeader) <= snapshot_offset, "snapshot header does not fit");
+
+
+struct TableStats
+{
+	static const size_t probe_buckets_amount = 16;
+
+	size_t operations = 0;
+	size_t probes = 0;
+	size_t max_probes = 0;
+	size_t probe_buckets[probe_buckets_amount] = {};
+	size_t rehashes = 0;
+	double rehash_seconds = 0;
+	size_t capacity = 0;
+	size_t peak_capacity = 0;
+	double load_factor = 0;
+	double tombstone_ratio = 0;
+};
+
+
+ostream& operator <<(ostream &out, const TableStats &stats)
+{
+	out << "operations=" << stats.operations
+		<< " probes_avg=" << (stats.operations == 0 ? 0.0 : static_cast<double>(stats.probes) / stats.operations)
+		<< " probes_max=" << stats.max_probes
+		<< " rehashes=" << stats.rehashes
+		<< " rehash_ms=" << stats.rehash_seconds * 1000
+		<< " load_factor=" << stats.load_factor
+		<< " tombstone_ratio=" << stats.tombstone_ratio
+		<< " capacity=" << stats.capacity
+		<< " peak_capacity=" << stats.peak_capacity;
+	for (size_t i = 0; i < TableStats::probe_buckets_amount; ++i)
+	{
+		if (stats.probe_buckets[i] != 0)
+			out << " probes_lt_" << (size_t(2) << i) << '=' << stats.probe_buckets[i];
+	}
+	return out;
+}
+
+
 template <typename K, typename V>
 class Pair
 {
@@ -15,88 +208,168 @@ class Pair
 	V _value;
 	bool _free;
 	bool _avaible;
-	bool _last;
+	friend class HashTable<K, V>;
 	friend class HashMap<K, V>;
 
 
-	Pair() : _free(true), _avaible(false) {}
+	Pair() : _key(), _value(), _free(true), _avaible(false) {}
+
+
+	Pair(K _key, V _value) : _key(move(_key)), _value(move(_value)), _free(true), _avaible(false) {}
+
+
+	void take(Pair &from)
+	{
+		_key = move(from._key);
+		_value = move(from._value);
+		_free = false;
+		_avaible = true;
+	}
+
+
+	void clear_value()
+	{
+		_value = V();
+	}
+};
+
+
+template <typename K>
+class Pair<K, void>
+{
+	K _key;
+	bool _free;
+	bool _avaible;
+	friend class HashTable<K, void>;
+	friend class HashSet<K>;
+
+
+	Pair() : _key(), _free(true), _avaible(false) {}
+
+
+	void take(Pair &from)
+	{
+		_key = move(from._key);
+		_free = false;
+		_avaible = true;
+	}
 
 
-	Pair(K _key, V _value) : _key(_key), _value(_value), _free(true), _avaible(false), _last(false) {}
+	void clear_value()
+	{}
 };
 
 
 template <typename K, typename V>
-class HashMap
+class HashTable
 {
 public:
-	HashMap() : block_size(1), overflow_koef(0.75), size(0), size_non_null(0)
+	HashTable() : overflow_koef(0.75), tombstone_koef(0.25), block_size(1), size(0), size_non_null(0)
 	{
 		items = new Pair<K, V>[block_size];
 	};
 
 
-	HashMap(size_t size) : block_size(size), overflow_koef(0.75), size(0), size_non_null(0)
+	HashTable(size_t size) : overflow_koef(0.75), tombstone_koef(0.25), block_size(size), size(0), size_non_null(0)
 	{
 		items = new Pair<K, V>[block_size];
 	};
 
 
-	void insert(const K key, const V value)
+	void reserve(size_t amount)
 	{
-		size_t hash_value = get_hash(key);
-		while (!items[hash_value]._free && items[hash_value]._key != key)
-		{
-			if (hash_value != block_size - 1)
-				++hash_value;
-			else hash_value = 0;
-		}
-		if (items[hash_value]._key == key && items[hash_value]._avaible)
-		{
-			items[hash_value]._value = value;
-			return;
-		}
-		items[hash_value]._key = key;
-		items[hash_value]._value = value;
-		items[hash_value]._free = false;
-		items[hash_value]._avaible = true;
-		items[hash_value]._last = false;
-		++size;
-		++size_non_null;
-		if (static_cast<double>(size) / static_cast<double>(block_size) > overflow_koef)
-			rehash();
+		if (capacity_for(amount) > block_size)
+			rehash(capacity_for(amount));
 	}
 
 
-	void erase(const K key)
+	void shrink_to_fit()
 	{
-		size_t hash_value = get_hash(key);
-		while (items[hash_value]._key != key)
-		{
-			if (items[hash_value]._free)
-				return;
-			if (hash_value != block_size - 1)
-				++hash_value;
-			else hash_value = 0;
-		}
-		if (!items[hash_value]._avaible) return;
-		items[hash_value]._avaible = false;
-		if (size_non_null != 0)
-			size_non_null--;
+		if (capacity_for(size_non_null) < block_size || size != size_non_null)
+			rehash(capacity_for(size_non_null));
 	}
 
 
-	V find(const K key)
+	bool save(const string& path)
 	{
-		size_t hash_value = get_hash(key);
-		while (!items[hash_value]._free && items[hash_value]._key != key)
+		static_assert(is_trivially_copyable<Pair<K, V>>::value, "snapshot needs trivially copyable K and V");
+		SnapshotHeader header = { { 'H', 'M', 'A', 'P', 'S', 'N', 'P', '3' }, sizeof(K), ValueSize<V>::value, sizeof(Pair<K, V>),
+			overflow_koef, tombstone_koef, block_size, size, size_non_null, snapshot_hash_id() };
+		char padding[snapshot_offset] = {};
+		ofstream out(path, ios::binary | ios::trunc);
+		out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		out.write(padding, snapshot_offset - sizeof(header));
+		out.write(reinterpret_cast<const char*>(items), block_size * sizeof(Pair<K, V>));
+		out.close();
+		return !out.fail();
+	}
+
+
+	bool load(const string& path)
+	{
+		static_assert(is_trivially_copyable<Pair<K, V>>::value, "snapshot needs trivially copyable K and V");
+#ifndef _WIN32
+		int fd = open(path.c_str(), O_RDONLY);
+		if (fd < 0)
+			return false;
+		struct stat file_stat;
+		if (fstat(fd, &file_stat) != 0 || file_stat.st_size < static_cast<off_t>(snapshot_offset))
 		{
-			if (hash_value != block_size - 1)
-				++hash_value;
-			else hash_value = 0;
+			close(fd);
+			return false;
 		}
-		if (!items[hash_value]._avaible) return NULL;
-		return(items[hash_value]._value);
+		size_t file_size = static_cast<size_t>(file_stat.st_size);
+		void *base = mmap(nullptr, file_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+		close(fd);
+		if (base == MAP_FAILED)
+			return false;
+		const SnapshotHeader *header = static_cast<const SnapshotHeader*>(base);
+		if (!snapshot_matches(*header, file_size)
+			|| !slots_match(reinterpret_cast<const Pair<K, V>*>(static_cast<char*>(base) + snapshot_offset), *header))
+		{
+			munmap(base, file_size);
+			return false;
+		}
+		madvise(base, file_size, MADV_RANDOM);
+		release_items();
+		mapping = base;
+		mapping_size = file_size;
+		items = reinterpret_cast<Pair<K, V>*>(static_cast<char*>(base) + snapshot_offset);
+#else
+		ifstream in(path, ios::binary | ios::ate);
+		if (!in)
+			return false;
+		size_t file_size = static_cast<size_t>(in.tellg());
+		SnapshotHeader snapshot_header;
+		in.seekg(0);
+		if (file_size < snapshot_offset || !in.read(reinterpret_cast<char*>(&snapshot_header), sizeof(snapshot_header)))
+			return false;
+		const SnapshotHeader *header = &snapshot_header;
+		if (!snapshot_matches(*header, file_size))
+			return false;
+		Pair<K, V> *new_items = new Pair<K, V>[header->block_size];
+		in.seekg(snapshot_offset);
+		if (!in.read(reinterpret_cast<char*>(new_items), header->block_size * sizeof(Pair<K, V>)) || !slots_match(new_items, *header))
+		{
+			delete[] new_items;
+			return false;
+		}
+		release_items();
+		items = new_items;
+#endif
+		overflow_koef = header->overflow_koef;
+		tombstone_koef = header->tombstone_koef;
+		block_size = header->block_size;
+		size = header->size;
+		size_non_null = header->size_non_null;
+		return true;
+	}
+
+
+	template <typename Q>
+	bool contains(const Q& key)
+	{
+		return items[find_slot(key)]._avaible;
 	}
 
 
@@ -106,274 +379,2242 @@ public:
 	}
 
 
-	size_t get_amount_unique()
+	size_t get_capacity()
 	{
-		if (size_non_null == 0)
-			return 0;
-		unique_values.clear();
-		for (size_t i = 0; i < block_size && unique_values.size() != size_non_null; ++i)
+		return block_size;
+	}
+
+
+	size_t get_memory_usage()
+	{
+		return block_size * sizeof(Pair<K, V>);
+	}
+
+
+	vector<size_t> get_probe_histogram()
+	{
+		vector<size_t> histogram;
+		for (size_t i = 0; i < block_size; ++i)
 		{
-			if (!items[i]._free && items[i]._avaible)
-			{
-				unique_values.insert(items[i]._value);
-			}
+			if (!items[i]._avaible)
+				continue;
+			size_t probes = (i + block_size - get_hash(items[i]._key)) % block_size + 1;
+			if (histogram.size() <= probes)
+				histogram.resize(probes + 1);
+			++histogram[probes];
 		}
-		return unique_values.size();
+		return histogram;
 	}
 
 
-	class Iterator
+	TableStats stats() const
 	{
-		Pair <K, V> *pair_ptr;
-		K pair_key;
-		V pair_value;
-		friend class HashMap<K, V>;
+		TableStats result;
+		HASHMAP_STAT(result = counters;)
+		result.capacity = block_size;
+		result.peak_capacity = max(result.peak_capacity, block_size);
+		result.load_factor = static_cast<double>(size_non_null) / block_size;
+		result.tombstone_ratio = static_cast<double>(size - size_non_null) / block_size;
+		return result;
+	}
+
+
+#ifdef HASHMAP_STATS
+	void set_stats_hook(size_t period, function<void(const TableStats&)> hook)
+	{
+		stats_period = period;
+		stats_hook = move(hook);
+	}
+#endif
 
-		Iterator(Pair<K, V> *pair_ptr) : pair_ptr(pair_ptr)
+
+	class Iterator
+	{
+	public:
+		const K& get_key() const
 		{
-			if (pair_ptr != nullptr)
-			{
-				pair_key = pair_ptr->_key;
-				pair_value = pair_ptr->_value;
-			}
+			return pair_ptr->_key;
 		}
 
 
-		Iterator& operator =(Iterator &that)
+		auto& get_value() const
 		{
-			if (this != &that)
-			{
-				pair_ptr = that.pair_ptr;
-				pair_key = that.pair_key;
-				pair_value = that.pair_value;
-			}
-			return *this;
+			return pair_ptr->_value;
 		}
 
 
-		bool operator ==(Iterator &that)
+		bool operator ==(const Iterator &that) const
 		{
 			return (pair_ptr == that.pair_ptr);
 		}
 
 
-		bool operator !=(Iterator &that)
+		bool operator !=(const Iterator &that) const
 		{
 			return !(pair_ptr == that.pair_ptr);
 		}
 
 
-		Iterator operator++()
+		Iterator& operator++()
 		{
-			if (pair_ptr->_last)
-			{
-				pair_ptr = nullptr;
-			}
-			else
-			{
-				++pair_ptr;
-				pair_key = pair_ptr->_key;
-				pair_value = pair_ptr->_value;
-			}
-			return Iterator(pair_ptr);
+			++pair_ptr;
+			skip_empty();
+			return *this;
 		}
 
 
-		Iterator operator++(int n)
+		Iterator operator++(int)
 		{
-			Iterator temp = this;
-			++this;
+			Iterator temp = *this;
+			++*this;
 			return temp;
 		}
+
+	private:
+		Pair <K, V> *pair_ptr;
+		Pair <K, V> *end_ptr;
+		friend class HashTable<K, V>;
+
+		Iterator(Pair<K, V> *pair_ptr, Pair<K, V> *end_ptr) : pair_ptr(pair_ptr), end_ptr(end_ptr)
+		{
+			skip_empty();
+		}
+
+
+		void skip_empty()
+		{
+			while (pair_ptr != end_ptr && !pair_ptr->_avaible)
+				++pair_ptr;
+		}
 	};
 
 
 	Iterator begin()
 	{
-		size_t i = 0;
-		Iterator iter(&items[i]);
-		return iter;
+		return Iterator(items, items + block_size);
 	}
 
 
 	Iterator end()
 	{
-		Iterator iter(nullptr);
-		items[block_size - 1]._last = true;
-		return iter;
+		return Iterator(items + block_size, items + block_size);
 	}
 
 
-	~HashMap()
+	~HashTable()
 	{
-		delete[] items;
+		release_items();
 	}
-private:
+protected:
 	Pair <K, V> *items = nullptr;
+	void *mapping = nullptr;
+	size_t mapping_size = 0;
 	float overflow_koef;
+	float tombstone_koef;
 	size_t block_size;
 	size_t size;
 	size_t size_non_null;
-	set <V> unique_values;
+#ifdef HASHMAP_STATS
+	mutable TableStats counters;
+	size_t stats_period = 0;
+	function<void(const TableStats&)> stats_hook;
 
 
-	size_t get_hash(K key)
+	void record_probes(size_t probes) const
 	{
-		hash<K> hash_func;
-		return hash_func(key) % block_size;
+		size_t bucket = 0;
+		while (bucket + 1 < TableStats::probe_buckets_amount && (size_t(2) << bucket) <= probes)
+			++bucket;
+		++counters.operations;
+		counters.probes += probes;
+		counters.max_probes = max(counters.max_probes, probes);
+		++counters.probe_buckets[bucket];
+		if (stats_period != 0 && counters.operations % stats_period == 0 && stats_hook)
+			stats_hook(stats());
 	}
+#endif
 
 
-	void rehash()
+	template <typename Q>
+	size_t get_hash(const Q& key) const
 	{
-		HashMap new_map(block_size * 2);
-		for (auto i = begin(); i != end(); ++i)
-		{
-			if (i.pair_ptr->_avaible)
-				new_map.insert(i.pair_key, i.pair_value);
-		}
-		swap(items, new_map.items);
-		block_size *= 2;
-		items[block_size - 1]._last = true;
+		return KeyHash<K>()(key) % block_size;
 	}
-};
-
-
-template <typename K, typename V>
-class MultiHashMap : public HashMap <K, V>
-{
-public:
-	MultiHashMap() : HashMap<K, V>()
-	{}
-
-
-	MultiHashMap(size_t size) : HashMap<K, V>(size)
-	{}
 
 
-	void insert(const K key, const V value)
+	template <typename Q>
+	size_t find_slot(const Q& key) const
 	{
 		size_t hash_value = get_hash(key);
-		while (!items[hash_value]._free)
+		HASHMAP_STAT(size_t probes = 1;)
+		while (!items[hash_value]._free && !(items[hash_value]._key == key))
 		{
-			if (items[hash_value]._key == key && !items[hash_value]._avaible)
-			{
-				break;
-			}
+			HASHMAP_STAT(++probes;)
 			if (hash_value != block_size - 1)
 				++hash_value;
 			else hash_value = 0;
 		}
-		items[hash_value]._key = key;
-		items[hash_value]._value = value;
-		items[hash_value]._free = false;
-		items[hash_value]._avaible = true;
-		++size;
-		++size_non_null;
-		if (static_cast<float>(size / block_size) > overflow_koef)
-			rehash();
+		HASHMAP_STAT(record_probes(probes);)
+		return hash_value;
 	}
 
 
-	void erase(const K key)
+	template <typename Q>
+	size_t find_insert_slot(const Q& key) const
 	{
 		size_t hash_value = get_hash(key);
-		while (!items[hash_value]._free)
+		size_t first_dead = block_size;
+		HASHMAP_STAT(size_t probes = 1;)
+		while (!items[hash_value]._free && !(items[hash_value]._key == key))
 		{
-			if (items[hash_value]._key == key && items[hash_value]._avaible)
-			{
-				items[hash_value]._avaible = false;
-				if (size_non_null != 0)
-					size_non_null--;
-			}
+			HASHMAP_STAT(++probes;)
+			if (first_dead == block_size && !items[hash_value]._avaible)
+				first_dead = hash_value;
 			if (hash_value != block_size - 1)
 				++hash_value;
 			else hash_value = 0;
 		}
+		HASHMAP_STAT(record_probes(probes);)
+		if (items[hash_value]._free && first_dead != block_size)
+			return first_dead;
+		return hash_value;
 	}
 
 
-	size_t get_amount_by_key(K key)
+	bool snapshot_matches(const SnapshotHeader& header, size_t file_size) const
 	{
-		size_t amount = 0;
-		size_t hash_value = get_hash(key);
-		while (!items[hash_value]._free)
-		{
-			if (items[hash_value]._key == key && items[hash_value]._avaible)
-			{
-				amount++;
-			}
-			if (hash_value != block_size - 1)
-				++hash_value;
-			else hash_value = 0;
-		}
-		return amount;
+		return memcmp(header.magic, "HMAPSNP3", sizeof(header.magic)) == 0
+			&& header.key_size == sizeof(K) && header.value_size == ValueSize<V>::value && header.slot_size == sizeof(Pair<K, V>)
+			&& header.hash_id == snapshot_hash_id()
+			&& header.overflow_koef > 0 && header.overflow_koef < 1 && header.tombstone_koef >= 0
+			&& header.size_non_null <= header.size && header.size < header.block_size
+			&& file_size == snapshot_offset + header.block_size * sizeof(Pair<K, V>);
 	}
 
 
-	vector get_elements_by_key(K key)
+	bool slots_match(const Pair<K, V> *slots, const SnapshotHeader& header) const
 	{
-		vector<V> elem_vect;
-		size_t hash_value = get_hash(key);
-		while (!items[hash_value]._free)
+		size_t occupied = 0;
+		size_t live = 0;
+		for (size_t i = 0; i < header.block_size; ++i)
 		{
-			if (items[hash_value]._key == key && items[hash_value]._avaible)
-			{
-				elem_vect.push_back(items[hash_value]._value);
-			}
-			if (hash_value != block_size - 1)
-				++hash_value;
-			else hash_value = 0;
+			unsigned char free_flag = *reinterpret_cast<const unsigned char*>(&slots[i]._free);
+			unsigned char live_flag = *reinterpret_cast<const unsigned char*>(&slots[i]._avaible);
+			if (free_flag > 1 || live_flag > 1 || (free_flag && live_flag))
+				return false;
+			occupied += !free_flag;
+			live += live_flag;
 		}
-		return elem_vect;
+		return occupied == header.size && live == header.size_non_null;
 	}
 
-	~MultiHashMap()
-	{}
-};
 
+	static uint64_t snapshot_hash_id()
+	{
+		return key_hash_version ^ hash<string_view>()("HMAPSNP") ^ KeyHash<K>()(K());
+	}
 
-template <typename K, typename V>
-void task_hashmap()
-{
-	K key;
-	V value;
-	char sym;
-	int n;
-	std::cin >> n;
-	HashMap<K, V> hash;
-	for (int i = 0; i < n; i++)
+
+	void release_items()
 	{
-		cin >> sym;
-		if (sym == 'A')
-		{
-			cin >> key >> value;
-			hash.insert(key, value);
-		}
-		else
+#ifndef _WIN32
+		if (mapping != nullptr)
 		{
-			std::cin >> key;
-			hash.erase(key);
+			munmap(mapping, mapping_size);
+			mapping = nullptr;
+			mapping_size = 0;
+			items = nullptr;
+			return;
 		}
+#endif
+		delete[] items;
+		items = nullptr;
 	}
-	std::cout << hash.get_size() << ' ' << hash.get_amount_unique();
-}
 
 
-template<typename K>
-void temp_v(char v_type)
-{
-	if (v_type == 'I')
-		task_hashmap<K, int>();
-	if (v_type == 'S')
-		task_hashmap<K, string>();
-	if (v_type == 'D')
-		task_hashmap<K, double>();
+	size_t capacity_for(size_t amount) const
+	{
+		return static_cast<size_t>(amount / overflow_koef) + 1;
+	}
+
+
+	template <typename KK>
+	void occupy_slot(size_t hash_value, KK&& key)
+	{
+		if (!(items[hash_value]._key == key))
+			items[hash_value]._key = K(forward<KK>(key));
+		if (items[hash_value]._free)
+			++size;
+		items[hash_value]._free = false;
+		items[hash_value]._avaible = true;
+		++size_non_null;
+	}
+
+
+	void grow_if_needed()
+	{
+		if (static_cast<double>(size) / static_cast<double>(block_size) > overflow_koef)
+			rehash(size_non_null * 2 > block_size * overflow_koef ? block_size * 2 : block_size);
+	}
+
+
+	void erase_slot(size_t hash_value)
+	{
+		items[hash_value].clear_value();
+		items[hash_value]._avaible = false;
+		if (size_non_null != 0)
+			size_non_null--;
+		if (static_cast<double>(size - size_non_null) > block_size * tombstone_koef)
+			rehash(block_size);
+	}
+
+
+	void rehash(size_t new_block_size)
+	{
+		HASHMAP_STAT(auto rehash_start = chrono::steady_clock::now();)
+		Pair<K, V> *new_items = new Pair<K, V>[new_block_size];
+		for (size_t i = 0; i < block_size; ++i)
+		{
+			if (!items[i]._avaible)
+				continue;
+			size_t hash_value = KeyHash<K>()(items[i]._key) % new_block_size;
+			while (!new_items[hash_value]._free)
+			{
+				if (hash_value != new_block_size - 1)
+					++hash_value;
+				else hash_value = 0;
+			}
+			new_items[hash_value].take(items[i]);
+		}
+		release_items();
+		items = new_items;
+		HASHMAP_STAT(counters.peak_capacity = max(counters.peak_capacity, block_size);)
+		block_size = new_block_size;
+		size = size_non_null;
+		HASHMAP_STAT(
+		++counters.rehashes;
+		counters.rehash_seconds += chrono::duration<double>(chrono::steady_clock::now() - rehash_start).count();)
+	}
+};
+
+
+template <typename K, typename V>
+class HashMap : public HashTable<K, V>
+{
+	using HashTable<K, V>::items;
+	using HashTable<K, V>::block_size;
+	using HashTable<K, V>::find_slot;
+	using HashTable<K, V>::find_insert_slot;
+	using HashTable<K, V>::occupy_slot;
+	using HashTable<K, V>::grow_if_needed;
+	using HashTable<K, V>::erase_slot;
+public:
+	HashMap() : HashTable<K, V>()
+	{}
+
+
+	HashMap(size_t size) : HashTable<K, V>(size)
+	{}
+
+
+	void insert(const K& key, const V& value)
+	{
+		insert_or_assign(key, value);
+	}
+
+
+	void insert(K&& key, V&& value)
+	{
+		insert_or_assign(move(key), move(value));
+	}
+
+
+	template <typename KK, typename... Args>
+	bool insert_or_assign(KK&& key, Args&&... args)
+	{
+		size_t hash_value = find_insert_slot(key);
+		if (items[hash_value]._avaible)
+		{
+			uncount_value(items[hash_value]._value);
+			items[hash_value]._value = V(forward<Args>(args)...);
+			count_value(items[hash_value]._value);
+			return false;
+		}
+		occupy(hash_value, forward<KK>(key), forward<Args>(args)...);
+		return true;
+	}
+
+
+	template <typename KK, typename... Args>
+	bool emplace(KK&& key, Args&&... args)
+	{
+		return try_emplace(forward<KK>(key), forward<Args>(args)...);
+	}
+
+
+	template <typename KK, typename... Args>
+	bool try_emplace(KK&& key, Args&&... args)
+	{
+		size_t hash_value = find_insert_slot(key);
+		if (items[hash_value]._avaible)
+			return false;
+		occupy(hash_value, forward<KK>(key), forward<Args>(args)...);
+		return true;
+	}
+
+
+	template <typename Q>
+	void erase(const Q& key)
+	{
+		size_t hash_value = find_slot(key);
+		if (!items[hash_value]._avaible) return;
+		uncount_value(items[hash_value]._value);
+		erase_slot(hash_value);
+	}
+
+
+	bool load(const string& path)
+	{
+		if (!HashTable<K, V>::load(path))
+			return false;
+		value_counts.reset();
+		approx_unique.reset();
+		return true;
+	}
+
+
+	template <typename Q>
+	V find(const Q& key)
+	{
+		size_t hash_value = find_slot(key);
+		if (!items[hash_value]._avaible) return V();
+		return(items[hash_value]._value);
+	}
+
+
+	template <typename Q>
+	V* get_value_ptr(const Q& key)
+	{
+		size_t hash_value = find_slot(key);
+		if (!items[hash_value]._avaible) return nullptr;
+		return &items[hash_value]._value;
+	}
+
+
+	size_t get_memory_usage()
+	{
+		size_t memory = HashTable<K, V>::get_memory_usage();
+		if (value_counts)
+			memory += value_counts->get_memory_usage();
+		if (approx_unique)
+			memory += approx_unique->get_memory_usage();
+		return memory;
+	}
+
+
+	size_t get_amount_unique()
+	{
+		if (approx_unique)
+			return approx_unique->estimate();
+		if (!value_counts)
+		{
+			value_counts.reset(new HashMap<V, size_t>);
+			for (size_t i = 0; i < block_size; ++i)
+			{
+				if (items[i]._avaible)
+					count_value(items[i]._value);
+			}
+		}
+		return value_counts->get_size();
+	}
+
+
+	void use_approx_unique(unsigned char precision)
+	{
+		precision = min(max(precision, HyperLogLog::min_precision), HyperLogLog::max_precision);
+		value_counts.reset();
+		approx_unique.reset(new HyperLogLog(precision));
+		for (size_t i = 0; i < block_size; ++i)
+		{
+			if (items[i]._avaible)
+				count_value(items[i]._value);
+		}
+	}
+
+
+private:
+	unique_ptr<HashMap<V, size_t>> value_counts;
+	unique_ptr<HyperLogLog> approx_unique;
+
+
+	template <typename KK, typename... Args>
+	void occupy(size_t hash_value, KK&& key, Args&&... args)
+	{
+		occupy_slot(hash_value, forward<KK>(key));
+		items[hash_value]._value = V(forward<Args>(args)...);
+		count_value(items[hash_value]._value);
+		grow_if_needed();
+	}
+
+
+	void count_value(const V& value)
+	{
+		if (value_counts)
+		{
+			size_t *amount = value_counts->get_value_ptr(value);
+			if (amount != nullptr)
+				++*amount;
+			else
+				value_counts->try_emplace(value, 1);
+		}
+		else if (approx_unique)
+		{
+			approx_unique->add(KeyHash<V>()(value));
+		}
+	}
+
+
+	void uncount_value(const V& value)
+	{
+		if (!value_counts)
+			return;
+		size_t *amount = value_counts->get_value_ptr(value);
+		if (--*amount == 0)
+			value_counts->erase(value);
+	}
+};
+
+
+template <typename K>
+class HashSet : public HashTable<K, void>
+{
+	using HashTable<K, void>::items;
+	using HashTable<K, void>::find_slot;
+	using HashTable<K, void>::find_insert_slot;
+	using HashTable<K, void>::occupy_slot;
+	using HashTable<K, void>::grow_if_needed;
+	using HashTable<K, void>::erase_slot;
+public:
+	HashSet() : HashTable<K, void>()
+	{}
+
+
+	HashSet(size_t size) : HashTable<K, void>(size)
+	{}
+
+
+	template <typename KK>
+	bool insert(KK&& key)
+	{
+		size_t hash_value = find_insert_slot(key);
+		if (items[hash_value]._avaible)
+			return false;
+		occupy_slot(hash_value, forward<KK>(key));
+		grow_if_needed();
+		return true;
+	}
+
+
+	template <typename Q>
+	bool erase(const Q& key)
+	{
+		size_t hash_value = find_slot(key);
+		if (!items[hash_value]._avaible)
+			return false;
+		erase_slot(hash_value);
+		return true;
+	}
+};
+
+
+template <typename K, typename V>
+class ColumnHashMap
+{
+	static constexpr uint8_t slot_free = 0;
+	static constexpr uint8_t slot_live = 1;
+	static constexpr uint8_t slot_dead = 2;
+public:
+	ColumnHashMap() : ColumnHashMap(1)
+	{}
+
+
+	ColumnHashMap(size_t size) : overflow_koef(0.75), tombstone_koef(0.25), block_size(max<size_t>(size, 1)), size(0), size_non_null(0)
+	{
+		control.assign(block_size, slot_free);
+		keys.resize(block_size);
+		values.resize(block_size);
+	}
+
+
+	void insert(const K& key, const V& value)
+	{
+		put(key, value);
+	}
+
+
+	void insert(K&& key, V&& value)
+	{
+		put(move(key), move(value));
+	}
+
+
+	template <typename Q>
+	void erase(const Q& key)
+	{
+		size_t slot = find_slot(key);
+		if (control[slot] != slot_live)
+			return;
+		values[slot] = V();
+		control[slot] = slot_dead;
+		--size_non_null;
+		if (static_cast<double>(size - size_non_null) > block_size * tombstone_koef)
+			rehash(block_size);
+	}
+
+
+	template <typename Q>
+	V find(const Q& key)
+	{
+		size_t slot = find_slot(key);
+		if (control[slot] != slot_live) return V();
+		return values[slot];
+	}
+
+
+	template <typename Q>
+	V* get_value_ptr(const Q& key)
+	{
+		size_t slot = find_slot(key);
+		if (control[slot] != slot_live) return nullptr;
+		return &values[slot];
+	}
+
+
+	template <typename Q>
+	bool contains(const Q& key)
+	{
+		return control[find_slot(key)] == slot_live;
+	}
+
+
+	void reserve(size_t amount)
+	{
+		if (static_cast<size_t>(amount / overflow_koef) + 1 > block_size)
+			rehash(static_cast<size_t>(amount / overflow_koef) + 1);
+	}
+
+
+	size_t get_size()
+	{
+		return size_non_null;
+	}
+
+
+	size_t get_capacity()
+	{
+		return block_size;
+	}
+
+
+	size_t get_memory_usage()
+	{
+		return block_size * (sizeof(uint8_t) + sizeof(K) + sizeof(V));
+	}
+
+
+	vector<size_t> get_probe_histogram()
+	{
+		vector<size_t> histogram;
+		for (size_t i = 0; i < block_size; ++i)
+		{
+			if (control[i] != slot_live)
+				continue;
+			size_t probes = (i + block_size - KeyHash<K>()(keys[i]) % block_size) % block_size + 1;
+			if (histogram.size() <= probes)
+				histogram.resize(probes + 1);
+			++histogram[probes];
+		}
+		return histogram;
+	}
+
+
+	V sum_values() const
+	{
+		V result = V();
+		for (size_t i = 0; i < block_size; ++i)
+			result += values[i];
+		return result;
+	}
+
+
+	template <typename P>
+	size_t count_values_if(P pred) const
+	{
+		size_t result = 0;
+		for (size_t i = 0; i < block_size; ++i)
+			result += (control[i] == slot_live) & static_cast<bool>(pred(values[i]));
+		return result;
+	}
+
+
+	template <typename F>
+	void for_each_value(F func) const
+	{
+		for (size_t i = 0; i < block_size; ++i)
+		{
+			if (control[i] == slot_live)
+				func(values[i]);
+		}
+	}
+
+
+	size_t get_amount_unique() const
+	{
+		HashSet<V> unique;
+		for_each_value([&unique](const V& value) { unique.insert(value); });
+		return unique.get_size();
+	}
+
+
+	class Iterator
+	{
+	public:
+		const K& get_key() const
+		{
+			return map->keys[slot];
+		}
+
+
+		V& get_value() const
+		{
+			return map->values[slot];
+		}
+
+
+		bool operator ==(const Iterator &that) const
+		{
+			return slot == that.slot;
+		}
+
+
+		bool operator !=(const Iterator &that) const
+		{
+			return !(*this == that);
+		}
+
+
+		Iterator& operator++()
+		{
+			++slot;
+			skip_empty();
+			return *this;
+		}
+
+
+		Iterator operator++(int)
+		{
+			Iterator temp = *this;
+			++*this;
+			return temp;
+		}
+
+	private:
+		ColumnHashMap *map;
+		size_t slot;
+		friend class ColumnHashMap<K, V>;
+
+		Iterator(ColumnHashMap *map, size_t slot) : map(map), slot(slot)
+		{
+			skip_empty();
+		}
+
+
+		void skip_empty()
+		{
+			while (slot != map->block_size && map->control[slot] != slot_live)
+				++slot;
+		}
+	};
+
+
+	Iterator begin()
+	{
+		return Iterator(this, 0);
+	}
+
+
+	Iterator end()
+	{
+		return Iterator(this, block_size);
+	}
+private:
+	float overflow_koef;
+	float tombstone_koef;
+	size_t block_size;
+	size_t size;
+	size_t size_non_null;
+	vector<uint8_t> control;
+	vector<K> keys;
+	vector<V> values;
+
+
+	template <typename Q>
+	size_t find_slot(const Q& key) const
+	{
+		size_t slot = KeyHash<K>()(key) % block_size;
+		while (control[slot] != slot_free && !(keys[slot] == key))
+		{
+			if (slot != block_size - 1)
+				++slot;
+			else slot = 0;
+		}
+		return slot;
+	}
+
+
+	template <typename Q>
+	size_t find_insert_slot(const Q& key) const
+	{
+		size_t slot = KeyHash<K>()(key) % block_size;
+		size_t first_dead = block_size;
+		while (control[slot] != slot_free && !(keys[slot] == key))
+		{
+			if (first_dead == block_size && control[slot] == slot_dead)
+				first_dead = slot;
+			if (slot != block_size - 1)
+				++slot;
+			else slot = 0;
+		}
+		if (control[slot] == slot_free && first_dead != block_size)
+			return first_dead;
+		return slot;
+	}
+
+
+	template <typename KK, typename VV>
+	void put(KK&& key, VV&& value)
+	{
+		size_t slot = find_insert_slot(key);
+		if (control[slot] == slot_live)
+		{
+			values[slot] = forward<VV>(value);
+			return;
+		}
+		if (control[slot] == slot_free)
+			++size;
+		if (!(keys[slot] == key))
+			keys[slot] = K(forward<KK>(key));
+		values[slot] = forward<VV>(value);
+		control[slot] = slot_live;
+		++size_non_null;
+		if (static_cast<double>(size) / static_cast<double>(block_size) > overflow_koef)
+			rehash(size_non_null * 2 > block_size * overflow_koef ? block_size * 2 : block_size);
+	}
+
+
+	void rehash(size_t new_block_size)
+	{
+		vector<uint8_t> new_control(new_block_size, slot_free);
+		vector<K> new_keys(new_block_size);
+		vector<V> new_values(new_block_size);
+		for (size_t i = 0; i < block_size; ++i)
+		{
+			if (control[i] != slot_live)
+				continue;
+			size_t slot = KeyHash<K>()(keys[i]) % new_block_size;
+			while (new_control[slot] != slot_free)
+			{
+				if (slot != new_block_size - 1)
+					++slot;
+				else slot = 0;
+			}
+			new_control[slot] = slot_live;
+			new_keys[slot] = move(keys[i]);
+			new_values[slot] = move(values[i]);
+		}
+		control.swap(new_control);
+		keys.swap(new_keys);
+		values.swap(new_values);
+		block_size = new_block_size;
+		size = size_non_null;
+	}
+};
+
+
+template <typename K, typename V>
+class FlatTreeMap
+{
+	static const size_t node_capacity = 64 / sizeof(K) > 4 ? 64 / sizeof(K) : 4;
+	static const size_t max_height = 32;
+	static const uint32_t no_leaf = UINT32_MAX;
+
+	struct alignas(64) Leaf
+	{
+		K keys[node_capacity];
+		V values[node_capacity];
+		uint32_t amount = 0;
+		uint32_t next = no_leaf;
+	};
+
+	struct alignas(64) Inner
+	{
+		K keys[node_capacity];
+		uint32_t children[node_capacity + 1];
+		uint32_t amount = 0;
+	};
+public:
+	FlatTreeMap() : root(0), height(0), size_non_null(0)
+	{
+		leaves.emplace_back();
+	}
+
+
+	bool insert(const K& key, const V& value)
+	{
+		uint32_t path[max_height];
+		uint32_t node = root;
+		for (size_t level = 0; level < height; ++level)
+		{
+			path[level] = node;
+			node = inners[node].children[child_position(inners[node], key)];
+		}
+		size_t pos = key_position(leaves[node], key);
+		if (pos < leaves[node].amount && leaves[node].keys[pos] == key)
+		{
+			leaves[node].values[pos] = value;
+			return false;
+		}
+		++size_non_null;
+		if (leaves[node].amount < node_capacity)
+		{
+			insert_into_leaf(leaves[node], pos, key, value);
+			return true;
+		}
+
+		uint32_t right_id = static_cast<uint32_t>(leaves.size());
+		leaves.emplace_back();
+		Leaf &left = leaves[node];
+		Leaf &right = leaves[right_id];
+		size_t half = node_capacity / 2;
+		for (size_t i = half; i < node_capacity; ++i)
+		{
+			right.keys[i - half] = move(left.keys[i]);
+			right.values[i - half] = move(left.values[i]);
+		}
+		right.amount = static_cast<uint32_t>(node_capacity - half);
+		left.amount = static_cast<uint32_t>(half);
+		right.next = left.next;
+		left.next = right_id;
+		if (pos <= half)
+			insert_into_leaf(left, pos, key, value);
+		else
+			insert_into_leaf(right, pos - half, key, value);
+
+		K separator = right.keys[0];
+		uint32_t child = right_id;
+		for (size_t level = height; level-- > 0;)
+		{
+			if (insert_into_inner(path[level], separator, child))
+				return true;
+		}
+		uint32_t new_root = static_cast<uint32_t>(inners.size());
+		inners.emplace_back();
+		inners[new_root].keys[0] = separator;
+		inners[new_root].children[0] = root;
+		inners[new_root].children[1] = child;
+		inners[new_root].amount = 1;
+		root = new_root;
+		++height;
+		return true;
+	}
+
+
+	bool erase(const K& key)
+	{
+		Leaf &leaf = leaves[find_leaf(key)];
+		size_t pos = key_position(leaf, key);
+		if (pos == leaf.amount || !(leaf.keys[pos] == key))
+			return false;
+		for (size_t i = pos + 1; i < leaf.amount; ++i)
+		{
+			leaf.keys[i - 1] = move(leaf.keys[i]);
+			leaf.values[i - 1] = move(leaf.values[i]);
+		}
+		--leaf.amount;
+		leaf.keys[leaf.amount] = K();
+		leaf.values[leaf.amount] = V();
+		--size_non_null;
+		return true;
+	}
+
+
+	V* get_value_ptr(const K& key)
+	{
+		Leaf &leaf = leaves[find_leaf(key)];
+		size_t pos = key_position(leaf, key);
+		if (pos == leaf.amount || !(leaf.keys[pos] == key))
+			return nullptr;
+		return &leaf.values[pos];
+	}
+
+
+	bool contains(const K& key)
+	{
+		return get_value_ptr(key) != nullptr;
+	}
+
+
+	size_t get_size()
+	{
+		return size_non_null;
+	}
+
+
+	size_t get_memory_usage()
+	{
+		return leaves.capacity() * sizeof(Leaf) + inners.capacity() * sizeof(Inner);
+	}
+
+
+	size_t get_height()
+	{
+		return height;
+	}
+
+
+	class Iterator
+	{
+	public:
+		const K& get_key() const
+		{
+			return tree->leaves[leaf].keys[pos];
+		}
+
+
+		V& get_value() const
+		{
+			return tree->leaves[leaf].values[pos];
+		}
+
+
+		bool operator ==(const Iterator &that) const
+		{
+			return leaf == that.leaf && pos == that.pos;
+		}
+
+
+		bool operator !=(const Iterator &that) const
+		{
+			return !(*this == that);
+		}
+
+
+		Iterator& operator++()
+		{
+			++pos;
+			skip_empty();
+			return *this;
+		}
+
+
+		Iterator operator++(int)
+		{
+			Iterator temp = *this;
+			++*this;
+			return temp;
+		}
+
+	private:
+		FlatTreeMap *tree;
+		uint32_t leaf;
+		size_t pos;
+		friend class FlatTreeMap<K, V>;
+
+		Iterator(FlatTreeMap *tree, uint32_t leaf, size_t pos) : tree(tree), leaf(leaf), pos(pos)
+		{
+			skip_empty();
+		}
+
+
+		void skip_empty()
+		{
+			while (leaf != no_leaf && pos >= tree->leaves[leaf].amount)
+			{
+				leaf = tree->leaves[leaf].next;
+				pos = 0;
+			}
+			if (leaf == no_leaf)
+				pos = 0;
+		}
+	};
+
+
+	Iterator begin()
+	{
+		return Iterator(this, 0, 0);
+	}
+
+
+	Iterator end()
+	{
+		return Iterator(this, no_leaf, 0);
+	}
+
+
+	Iterator lower_bound(const K& key)
+	{
+		uint32_t leaf = find_leaf(key);
+		return Iterator(this, leaf, key_position(leaves[leaf], key));
+	}
+
+
+	template <typename F>
+	void for_each_in_range(const K& from, const K& to, F func)
+	{
+		for (auto iter = lower_bound(from); iter != end() && iter.get_key() < to; ++iter)
+			func(iter.get_key(), iter.get_value());
+	}
+
+private:
+	vector<Leaf> leaves;
+	vector<Inner> inners;
+	uint32_t root;
+	size_t height;
+	size_t size_non_null;
+
+
+	static size_t key_position(const Leaf &leaf, const K& key)
+	{
+		size_t pos = 0;
+		while (pos < leaf.amount && leaf.keys[pos] < key)
+			++pos;
+		return pos;
+	}
+
+
+	static size_t child_position(const Inner &inner, const K& key)
+	{
+		size_t pos = 0;
+		while (pos < inner.amount && !(key < inner.keys[pos]))
+			++pos;
+		return pos;
+	}
+
+
+	uint32_t find_leaf(const K& key) const
+	{
+		uint32_t node = root;
+		for (size_t level = 0; level < height; ++level)
+			node = inners[node].children[child_position(inners[node], key)];
+		return node;
+	}
+
+
+	static void insert_into_leaf(Leaf &leaf, size_t pos, const K& key, const V& value)
+	{
+		for (size_t i = leaf.amount; i > pos; --i)
+		{
+			leaf.keys[i] = move(leaf.keys[i - 1]);
+			leaf.values[i] = move(leaf.values[i - 1]);
+		}
+		leaf.keys[pos] = key;
+		leaf.values[pos] = value;
+		++leaf.amount;
+	}
+
+
+	bool insert_into_inner(uint32_t node, K& separator, uint32_t& child)
+	{
+		K keys[node_capacity + 1];
+		uint32_t children[node_capacity + 2];
+		Inner &inner = inners[node];
+		size_t pos = child_position(inner, separator);
+		if (inner.amount < node_capacity)
+		{
+			for (size_t i = inner.amount; i > pos; --i)
+			{
+				inner.keys[i] = move(inner.keys[i - 1]);
+				inner.children[i + 1] = inner.children[i];
+			}
+			inner.keys[pos] = separator;
+			inner.children[pos + 1] = child;
+			++inner.amount;
+			return true;
+		}
+
+		for (size_t i = 0, j = 0; i <= node_capacity; ++i)
+			keys[i] = i == pos ? separator : move(inner.keys[j++]);
+		for (size_t i = 0, j = 0; i <= node_capacity + 1; ++i)
+			children[i] = i == pos + 1 ? child : inner.children[j++];
+		size_t mid = (node_capacity + 1) / 2;
+		uint32_t right_id = static_cast<uint32_t>(inners.size());
+		inners.emplace_back();
+		Inner &left = inners[node];
+		Inner &right = inners[right_id];
+		for (size_t i = 0; i < mid; ++i)
+		{
+			left.keys[i] = move(keys[i]);
+			left.children[i] = children[i];
+		}
+		left.children[mid] = children[mid];
+		left.amount = static_cast<uint32_t>(mid);
+		for (size_t i = mid + 1; i <= node_capacity; ++i)
+		{
+			right.keys[i - mid - 1] = move(keys[i]);
+			right.children[i - mid - 1] = children[i];
+		}
+		right.children[node_capacity - mid] = children[node_capacity + 1];
+		right.amount = static_cast<uint32_t>(node_capacity - mid);
+		separator = move(keys[mid]);
+		child = right_id;
+		return false;
+	}
+};
+
+
+template <typename V>
+class ValueSpan
+{
+public:
+	ValueSpan(const V *data, size_t amount) : data(data), amount(amount) {}
+
+
+	const V* begin() const
+	{
+		return data;
+	}
+
+
+	const V* end() const
+	{
+		return data + amount;
+	}
+
+
+	const V& operator[](size_t id) const
+	{
+		return data[id];
+	}
+
+
+	size_t size() const
+	{
+		return amount;
+	}
+
+
+	bool empty() const
+	{
+		return amount == 0;
+	}
+
+private:
+	const V *data;
+	size_t amount;
+};
+
+
+struct MultiHashMapStats : TableStats
+{
+	size_t compactions = 0;
+	double dead_value_ratio = 0;
+};
+
+
+ostream& operator <<(ostream &out, const MultiHashMapStats &stats)
+{
+	return out << static_cast<const TableStats&>(stats) << " compactions=" << stats.compactions
+		<< " dead_value_ratio=" << stats.dead_value_ratio;
+}
+
+
+template <typename K, typename V>
+class MultiHashMap
+{
+public:
+	MultiHashMap() : size_non_null(0), dead_values(0)
+	{}
+
+
+	MultiHashMap(size_t size) : run_ids(size), size_non_null(0), dead_values(0)
+	{}
+
+
+	void insert(const K& key, const V& value)
+	{
+		size_t *found_id = run_ids.get_value_ptr(key);
+		size_t run_id;
+		if (found_id != nullptr)
+		{
+			run_id = *found_id;
+		}
+		else
+		{
+			run_id = new_run();
+			runs[run_id] = ValueRun{ arena.size(), 0, 1 };
+			arena.emplace_back();
+			run_ids.insert(key, run_id);
+		}
+		ValueRun &run = runs[run_id];
+		if (run.amount == run.capacity)
+			grow_run(run);
+		arena[run.offset + run.amount] = value;
+		++run.amount;
+		++size_non_null;
+	}
+
+
+	void erase(const K& key)
+	{
+		size_t *run_id = run_ids.get_value_ptr(key);
+		if (run_id == nullptr)
+			return;
+		ValueRun &run = runs[*run_id];
+		for (size_t i = run.offset; i < run.offset + run.amount; ++i)
+			arena[i] = V();
+		size_non_null -= run.amount;
+		dead_values += run.capacity;
+		free_runs.push_back(*run_id);
+		run_ids.erase(key);
+		if (dead_values * 2 > arena.size())
+			compact();
+	}
+
+
+	size_t get_amount_by_key(const K& key)
+	{
+		size_t *run_id = run_ids.get_value_ptr(key);
+		if (run_id == nullptr)
+			return 0;
+		return runs[*run_id].amount;
+	}
+
+
+	ValueSpan<V> get_span_by_key(const K& key)
+	{
+		size_t *run_id = run_ids.get_value_ptr(key);
+		if (run_id == nullptr)
+			return ValueSpan<V>(nullptr, 0);
+		return ValueSpan<V>(arena.data() + runs[*run_id].offset, runs[*run_id].amount);
+	}
+
+
+	vector<V> get_elements_by_key(const K& key)
+	{
+		ValueSpan<V> span = get_span_by_key(key);
+		return vector<V>(span.begin(), span.end());
+	}
+
+
+	bool contains(const K& key)
+	{
+		return run_ids.contains(key);
+	}
+
+
+	size_t get_size()
+	{
+		return size_non_null;
+	}
+
+
+	size_t get_amount_keys()
+	{
+		return run_ids.get_size();
+	}
+
+
+	size_t get_capacity()
+	{
+		return run_ids.get_capacity();
+	}
+
+
+	size_t get_memory_usage()
+	{
+		return run_ids.get_memory_usage() + runs.capacity() * sizeof(ValueRun)
+			+ free_runs.capacity() * sizeof(size_t) + arena.capacity() * sizeof(V);
+	}
+
+
+	vector<size_t> get_probe_histogram()
+	{
+		return run_ids.get_probe_histogram();
+	}
+
+
+	MultiHashMapStats stats() const
+	{
+		MultiHashMapStats result;
+		static_cast<TableStats&>(result) = run_ids.stats();
+		HASHMAP_STAT(result.compactions = compactions;)
+		result.dead_value_ratio = arena.empty() ? 0.0 : static_cast<double>(dead_values) / arena.size();
+		return result;
+	}
+
+
+#ifdef HASHMAP_STATS
+	void set_stats_hook(size_t period, function<void(const TableStats&)> hook)
+	{
+		run_ids.set_stats_hook(period, move(hook));
+	}
+#endif
+
+
+	~MultiHashMap()
+	{}
+private:
+	struct ValueRun
+	{
+		size_t offset;
+		size_t amount;
+		size_t capacity;
+	};
+
+	HashMap<K, size_t> run_ids;
+	vector<ValueRun> runs;
+	vector<size_t> free_runs;
+	vector<V> arena;
+	size_t size_non_null;
+	size_t dead_values;
+	HASHMAP_STAT(size_t compactions = 0;)
+
+
+	size_t new_run()
+	{
+		if (free_runs.empty())
+		{
+			runs.emplace_back();
+			return runs.size() - 1;
+		}
+		size_t run_id = free_runs.back();
+		free_runs.pop_back();
+		return run_id;
+	}
+
+
+	void grow_run(ValueRun &run)
+	{
+		if (run.offset + run.capacity == arena.size())
+		{
+			arena.resize(arena.size() + run.capacity);
+		}
+		else
+		{
+			size_t new_offset = arena.size();
+			arena.resize(new_offset + run.capacity * 2);
+			for (size_t i = 0; i < run.amount; ++i)
+				arena[new_offset + i] = move(arena[run.offset + i]);
+			dead_values += run.capacity;
+			run.offset = new_offset;
+		}
+		run.capacity *= 2;
+		if (dead_values * 2 > arena.size())
+			compact();
+	}
+
+
+	void compact()
+	{
+		vector<V> new_arena;
+		new_arena.reserve(arena.size() - dead_values);
+		for (auto iter = run_ids.begin(); iter != run_ids.end(); ++iter)
+		{
+			ValueRun &run = runs[iter.get_value()];
+			size_t new_offset = new_arena.size();
+			for (size_t i = run.offset; i < run.offset + run.capacity; ++i)
+				new_arena.push_back(move(arena[i]));
+			run.offset = new_offset;
+		}
+		arena.swap(new_arena);
+		dead_values = 0;
+		HASHMAP_STAT(++compactions;)
+	}
+};
+
+
+enum class EvictionPolicy
+{
+	lru,
+	clock
+};
+
+
+template <typename K, typename V>
+class LruCache
+{
+	static const uint32_t no_entry = UINT32_MAX;
+
+	struct CacheEntry
+	{
+		K key;
+		V value;
+		chrono::steady_clock::time_point expires;
+		uint32_t prev = no_entry;
+		uint32_t next = no_entry;
+		bool referenced = false;
+	};
+public:
+	LruCache(size_t capacity, EvictionPolicy policy = EvictionPolicy::lru)
+		: capacity(max<size_t>(capacity, 1)), policy(policy), head(no_entry), tail(no_entry), free_head(no_entry), hand(0)
+	{
+		entries.reserve(this->capacity);
+		index.reserve(this->capacity);
+	}
+
+
+	void put(const K& key, const V& value, chrono::steady_clock::duration ttl = chrono::steady_clock::duration::zero())
+	{
+		auto expires = ttl == chrono::steady_clock::duration::zero() ? chrono::steady_clock::time_point::max()
+			: chrono::steady_clock::now() + ttl;
+		uint32_t *found = index.get_value_ptr(key);
+		if (found != nullptr)
+		{
+			entries[*found].value = value;
+			entries[*found].expires = expires;
+			touch(*found);
+			return;
+		}
+		uint32_t id = allocate();
+		CacheEntry &entry = entries[id];
+		entry.key = key;
+		entry.value = value;
+		entry.expires = expires;
+		entry.referenced = false;
+		if (policy == EvictionPolicy::lru)
+			link_front(id);
+		index.insert(key, id);
+	}
+
+
+	bool get(const K& key, V& value)
+	{
+		uint32_t *found = index.get_value_ptr(key);
+		if (found == nullptr)
+			return false;
+		uint32_t id = *found;
+		if (entries[id].expires != chrono::steady_clock::time_point::max() && entries[id].expires <= chrono::steady_clock::now())
+		{
+			remove(id);
+			return false;
+		}
+		touch(id);
+		value = entries[id].value;
+		return true;
+	}
+
+
+	bool erase(const K& key)
+	{
+		uint32_t *found = index.get_value_ptr(key);
+		if (found == nullptr)
+			return false;
+		remove(*found);
+		return true;
+	}
+
+
+	size_t get_size()
+	{
+		return index.get_size();
+	}
+
+
+	size_t get_capacity()
+	{
+		return capacity;
+	}
+private:
+	HashMap<K, uint32_t> index;
+	vector<CacheEntry> entries;
+	size_t capacity;
+	EvictionPolicy policy;
+	uint32_t head;
+	uint32_t tail;
+	uint32_t free_head;
+	size_t hand;
+
+
+	uint32_t allocate()
+	{
+		if (free_head != no_entry)
+		{
+			uint32_t id = free_head;
+			free_head = entries[id].next;
+			return id;
+		}
+		if (entries.size() < capacity)
+		{
+			entries.emplace_back();
+			return static_cast<uint32_t>(entries.size() - 1);
+		}
+		uint32_t victim;
+		if (policy == EvictionPolicy::lru)
+		{
+			victim = tail;
+			unlink(victim);
+		}
+		else
+		{
+			while (entries[hand].referenced)
+			{
+				entries[hand].referenced = false;
+				hand = hand + 1 == entries.size() ? 0 : hand + 1;
+			}
+			victim = static_cast<uint32_t>(hand);
+			hand = hand + 1 == entries.size() ? 0 : hand + 1;
+		}
+		index.erase(entries[victim].key);
+		return victim;
+	}
+
+
+	void remove(uint32_t id)
+	{
+		index.erase(entries[id].key);
+		if (policy == EvictionPolicy::lru)
+			unlink(id);
+		entries[id].value = V();
+		entries[id].referenced = false;
+		entries[id].next = free_head;
+		free_head = id;
+	}
+
+
+	void touch(uint32_t id)
+	{
+		if (policy == EvictionPolicy::clock)
+		{
+			entries[id].referenced = true;
+			return;
+		}
+		if (head == id)
+			return;
+		unlink(id);
+		link_front(id);
+	}
+
+
+	void link_front(uint32_t id)
+	{
+		entries[id].prev = no_entry;
+		entries[id].next = head;
+		if (head != no_entry)
+			entries[head].prev = id;
+		head = id;
+		if (tail == no_entry)
+			tail = id;
+	}
+
+
+	void unlink(uint32_t id)
+	{
+		CacheEntry &entry = entries[id];
+		if (entry.prev != no_entry)
+			entries[entry.prev].next = entry.next;
+		else
+			head = entry.next;
+		if (entry.next != no_entry)
+			entries[entry.next].prev = entry.prev;
+		else
+			tail = entry.prev;
+		entry.prev = no_entry;
+		entry.next = no_entry;
+	}
+};
+
+
+template <typename K, typename V>
+class ShardedCache
+{
+	struct alignas(64) Shard
+	{
+		mutex lock;
+		LruCache<K, V> cache;
+
+		Shard(size_t capacity, EvictionPolicy policy) : cache(capacity, policy)
+		{}
+	};
+public:
+	ShardedCache(size_t capacity, size_t shards_amount = 64, EvictionPolicy policy = EvictionPolicy::lru)
+	{
+		shards_amount = max<size_t>(shards_amount, 1);
+		for (size_t i = 0; i < shards_amount; ++i)
+			shards.push_back(make_unique<Shard>((capacity + shards_amount - 1) / shards_amount, policy));
+	}
+
+
+	void put(const K& key, const V& value, chrono::steady_clock::duration ttl = chrono::steady_clock::duration::zero())
+	{
+		Shard &shard = shard_for(key);
+		lock_guard<mutex> guard(shard.lock);
+		shard.cache.put(key, value, ttl);
+	}
+
+
+	bool get(const K& key, V& value)
+	{
+		Shard &shard = shard_for(key);
+		lock_guard<mutex> guard(shard.lock);
+		return shard.cache.get(key, value);
+	}
+
+
+	bool erase(const K& key)
+	{
+		Shard &shard = shard_for(key);
+		lock_guard<mutex> guard(shard.lock);
+		return shard.cache.erase(key);
+	}
+
+
+	size_t get_size()
+	{
+		size_t result = 0;
+		for (auto &shard : shards)
+		{
+			lock_guard<mutex> guard(shard->lock);
+			result += shard->cache.get_size();
+		}
+		return result;
+	}
+private:
+	vector<unique_ptr<Shard>> shards;
+
+
+	Shard& shard_for(const K& key)
+	{
+		return *shards[(KeyHash<K>()(key) >> (sizeof(size_t) * 4)) % shards.size()];
+	}
+};
+
+
+template <typename K, typename V>
+void task_hashmap()
+{
+	K key;
+	V value;
+	char sym;
+	int n;
+	std::cin >> n;
+	HashMap<K, V> hash;
+	for (int i = 0; i < n; i++)
+	{
+		cin >> sym;
+		if (sym == 'A')
+		{
+			cin >> key >> value;
+			hash.insert(move(key), move(value));
+		}
+		else
+		{
+			std::cin >> key;
+			hash.erase(key);
+		}
+	}
+	std::cout << hash.get_size() << ' ' << hash.get_amount_unique();
+}
+
+
+template<typename K>
+void temp_v(char v_type)
+{
+	if (v_type == 'I')
+		task_hashmap<K, int>();
+	if (v_type == 'S')
+		task_hashmap<K, string>();
+	if (v_type == 'D')
+		task_hashmap<K, double>();
+}
+
+
+template <typename K, typename V>
+struct BenchOp
+{
+	bool insert;
+	K key;
+	V value;
+};
+
+
+template <typename K, typename V>
+class HashMapBench
+{
+public:
+	const char* get_name() { return "HashMap"; }
+	void insert(const K& key, const V& value) { map.insert(key, value); }
+	void erase(const K& key) { map.erase(key); }
+	bool lookup(const K& key) { return map.contains(key); }
+	size_t get_size() { return map.get_size(); }
+	size_t get_capacity() { return map.get_capacity(); }
+	size_t get_memory_usage() { return map.get_memory_usage(); }
+	vector<size_t> get_probe_histogram() { return map.get_probe_histogram(); }
+private:
+	HashMap<K, V> map;
+};
+
+
+template <typename K, typename V>
+class ColumnHashMapBench
+{
+public:
+	const char* get_name() { return "ColumnHashMap"; }
+	void insert(const K& key, const V& value) { map.insert(key, value); }
+	void erase(const K& key) { map.erase(key); }
+	bool lookup(const K& key) { return map.contains(key); }
+	size_t get_size() { return map.get_size(); }
+	size_t get_capacity() { return map.get_capacity(); }
+	size_t get_memory_usage() { return map.get_memory_usage(); }
+	vector<size_t> get_probe_histogram() { return map.get_probe_histogram(); }
+private:
+	ColumnHashMap<K, V> map;
+};
+
+
+template <typename K, typename V>
+class MultiHashMapBench
+{
+public:
+	const char* get_name() { return "MultiHashMap"; }
+	void insert(const K& key, const V& value) { map.insert(key, value); }
+	void erase(const K& key) { map.erase(key); }
+	bool lookup(const K& key) { return map.get_amount_by_key(key) != 0; }
+	size_t get_size() { return map.get_size(); }
+	size_t get_capacity() { return map.get_capacity(); }
+	size_t get_memory_usage() { return map.get_memory_usage(); }
+	vector<size_t> get_probe_histogram() { return map.get_probe_histogram(); }
+private:
+	MultiHashMap<K, V> map;
+};
+
+
+template <typename K, typename V>
+class FlatTreeMapBench
+{
+public:
+	const char* get_name() { return "FlatTreeMap"; }
+	void insert(const K& key, const V& value) { map.insert(key, value); }
+	void erase(const K& key) { map.erase(key); }
+	bool lookup(const K& key) { return map.contains(key); }
+	size_t get_size() { return map.get_size(); }
+	size_t get_capacity() { return map.get_memory_usage(); }
+	size_t get_memory_usage() { return map.get_memory_usage(); }
+	vector<size_t> get_probe_histogram() { return vector<size_t>(); }
+private:
+	FlatTreeMap<K, V> map;
+};
+
+
+template <typename K, typename V>
+class UnorderedMapBench
+{
+public:
+	const char* get_name() { return "unordered_map"; }
+	void insert(const K& key, const V& value) { map[key] = value; }
+	void erase(const K& key) { map.erase(key); }
+	bool lookup(const K& key) { return map.find(key) != map.end(); }
+	size_t get_size() { return map.size(); }
+	size_t get_capacity() { return map.bucket_count(); }
+
+
+	size_t get_memory_usage()
+	{
+		return map.bucket_count() * sizeof(void*) + map.size() * (sizeof(pair<const K, V>) + 2 * sizeof(void*));
+	}
+
+
+	vector<size_t> get_probe_histogram()
+	{
+		vector<size_t> histogram;
+		for (size_t i = 0; i < map.bucket_count(); ++i)
+		{
+			size_t chain = map.bucket_size(i);
+			if (histogram.size() <= chain)
+				histogram.resize(chain + 1);
+			for (size_t probes = 1; probes <= chain; ++probes)
+				++histogram[probes];
+		}
+		return histogram;
+	}
+private:
+	unordered_map<K, V> map;
+};
+
+
+void print_probe_histogram(const vector<size_t>& histogram)
+{
+	size_t total = 0;
+	for (size_t amount : histogram)
+		total += amount;
+	if (total == 0)
+		return;
+	cout << "  probes:";
+	for (size_t low = 1; low < histogram.size(); low *= 2)
+	{
+		size_t amount = 0;
+		for (size_t probes = low; probes < histogram.size() && probes < low * 2; ++probes)
+			amount += histogram[probes];
+		if (amount == 0)
+			continue;
+		cout << ' ' << low;
+		if (low > 1)
+			cout << '-' << low * 2 - 1;
+		cout << ':' << 100.0 * amount / total << '%';
+	}
+	cout << '\n';
+}
+
+
+template <typename Bench, typename K, typename V>
+void run_bench_on(const vector<BenchOp<K, V>>& ops)
+{
+	Bench bench;
+	auto start = chrono::steady_clock::now();
+	for (const auto& op : ops)
+	{
+		if (op.insert)
+			bench.insert(op.key, op.value);
+		else
+			bench.erase(op.key);
+	}
+	chrono::duration<double> replay_time = chrono::steady_clock::now() - start;
+
+	size_t hits = 0;
+	start = chrono::steady_clock::now();
+	for (const auto& op : ops)
+		hits += bench.lookup(op.key);
+	chrono::duration<double> lookup_time = chrono::steady_clock::now() - start;
+
+	Bench paused;
+	vector<double> latencies(ops.size());
+	size_t resizes = 0;
+	for (size_t i = 0; i < ops.size(); ++i)
+	{
+		size_t capacity = paused.get_capacity();
+		auto op_start = chrono::steady_clock::now();
+		if (ops[i].insert)
+			paused.insert(ops[i].key, ops[i].value);
+		else
+			paused.erase(ops[i].key);
+		latencies[i] = chrono::duration<double, micro>(chrono::steady_clock::now() - op_start).count();
+		if (paused.get_capacity() != capacity)
+			++resizes;
+	}
+	double pause_total = 0;
+	size_t pauses = 0;
+	for (double latency : latencies)
+	{
+		if (latency > 100)
+		{
+			pause_total += latency;
+			++pauses;
+		}
+	}
+	sort(latencies.begin(), latencies.end());
+
+	cout << bench.get_name() << ": replay " << ops.size() / replay_time.count() / 1e6 << " Mops/s"
+		<< ", lookup " << ops.size() / lookup_time.count() / 1e6 << " Mops/s (" << hits << " hits)"
+		<< ", " << static_cast<double>(bench.get_memory_usage()) / max<size_t>(bench.get_size(), 1) << " bytes/entry"
+		<< ", " << resizes << " resizes\n";
+	if (!latencies.empty())
+	{
+		cout << "  latency: p99.9 " << latencies[latencies.size() * 999 / 1000] << " us, max " << latencies.back()
+			<< " us, " << pauses << " pauses over 100 us totalling " << pause_total / 1000 << " ms\n";
+	}
+	print_probe_histogram(bench.get_probe_histogram());
+}
+
+
+template <typename K, typename V>
+void run_bench(const vector<BenchOp<K, V>>& ops)
+{
+	run_bench_on<HashMapBench<K, V>>(ops);
+	run_bench_on<ColumnHashMapBench<K, V>>(ops);
+	run_bench_on<MultiHashMapBench<K, V>>(ops);
+	run_bench_on<FlatTreeMapBench<K, V>>(ops);
+	run_bench_on<UnorderedMapBench<K, V>>(ops);
+}
+
+
+template <typename K, typename V>
+void bench_trace()
+{
+	vector<BenchOp<K, V>> ops;
+	char sym;
+	int n;
+	cin >> n;
+	ops.resize(n);
+	for (int i = 0; i < n; i++)
+	{
+		cin >> sym >> ops[i].key;
+		ops[i].insert = (sym == 'A');
+		if (ops[i].insert)
+			cin >> ops[i].value;
+	}
+	run_bench(ops);
+}
+
+
+template<typename K>
+void bench_trace_v(char v_type)
+{
+	if (v_type == 'I')
+		bench_trace<K, int>();
+	if (v_type == 'S')
+		bench_trace<K, string>();
+	if (v_type == 'D')
+		bench_trace<K, double>();
+}
+
+
+void bench_scan(const vector<BenchOp<int, int>>& ops)
+{
+	HashMap<int, int> rows;
+	ColumnHashMap<int, int> columns;
+	for (const auto& op : ops)
+	{
+		if (op.insert)
+		{
+			rows.insert(op.key, op.value);
+			columns.insert(op.key, op.value);
+		}
+		else
+		{
+			rows.erase(op.key);
+			columns.erase(op.key);
+		}
+	}
+	const int rounds = 20;
+	long long row_sum = 0, column_sum = 0;
+	size_t row_count = 0, column_count = 0;
+	auto start = chrono::steady_clock::now();
+	for (int round = 0; round < rounds; ++round)
+	{
+		for (auto iter = rows.begin(); iter != rows.end(); ++iter)
+		{
+			row_sum += iter.get_value();
+			row_count += iter.get_value() < 500;
+		}
+	}
+	chrono::duration<double> row_time = chrono::steady_clock::now() - start;
+	start = chrono::steady_clock::now();
+	for (int round = 0; round < rounds; ++round)
+	{
+		column_sum += columns.sum_values();
+		column_count += columns.count_values_if([](int value) { return value < 500; });
+	}
+	chrono::duration<double> column_time = chrono::steady_clock::now() - start;
+	cout << "scan sum+filter: HashMap " << row_time.count() * 1000 / rounds << " ms, ColumnHashMap "
+		<< column_time.count() * 1000 / rounds << " ms" << (row_sum == column_sum && row_count == column_count ? "" : " (MISMATCH)") << '\n';
+}
+
+
+void bench_synthetic(const string& distribution, size_t amount, size_t keys)
+{
+	vector<BenchOp<int, int>> ops;
+	ops.reserve(amount);
+	mt19937_64 rng(42);
+	if (distribution == "sequential")
+	{
+		for (size_t i = 0; ops.size() < amount; ++i)
+		{
+			ops.push_back({ true, static_cast<int>(i), static_cast<int>(i) });
+			if (i >= keys && ops.size() < amount)
+				ops.push_back({ false, static_cast<int>(i - keys), 0 });
+		}
+	}
+	else
+	{
+		vector<double> zipf_cdf;
+		if (distribution == "zipf")
+		{
+			double sum = 0;
+			for (size_t i = 1; i <= keys; ++i)
+			{
+				sum += 1.0 / i;
+				zipf_cdf.push_back(sum);
+			}
+			for (double& weight : zipf_cdf)
+				weight /= sum;
+		}
+		uniform_real_distribution<double> unit(0, 1);
+		for (size_t i = 0; i < amount; ++i)
+		{
+			int key;
+			if (zipf_cdf.empty())
+				key = static_cast<int>(rng() % keys);
+			else
+				key = static_cast<int>(lower_bound(zipf_cdf.begin(), zipf_cdf.end(), unit(rng)) - zipf_cdf.begin());
+			ops.push_back({ rng() % 4 != 0, key, static_cast<int>(rng() % 1000) });
+		}
+	}
+	run_bench(ops);
+	bench_scan(ops);
+}
+
+
+void bench_cache(size_t amount, size_t keys, size_t threads_amount)
+{
+	threads_amount = max<size_t>(threads_amount, 1);
+	for (EvictionPolicy policy : { EvictionPolicy::lru, EvictionPolicy::clock })
+	{
+		ShardedCache<int, int> cache(keys / 2, threads_amount * 8, policy);
+		vector<size_t> hits(threads_amount);
+		vector<thread> threads;
+		auto start = chrono::steady_clock::now();
+		for (size_t t = 0; t < threads_amount; ++t)
+		{
+			threads.emplace_back([&, t]()
+			{
+				mt19937_64 rng(t + 1);
+				int value;
+				for (size_t i = 0; i < amount / threads_amount; ++i)
+				{
+					int key = static_cast<int>(rng() % keys);
+					if (cache.get(key, value))
+						++hits[t];
+					else
+						cache.put(key, key);
+				}
+			});
+		}
+		for (auto &worker : threads)
+			worker.join();
+		chrono::duration<double> time = chrono::steady_clock::now() - start;
+		size_t total_hits = 0;
+		for (size_t amount_hits : hits)
+			total_hits += amount_hits;
+		cout << (policy == EvictionPolicy::lru ? "lru" : "clock") << ": " << amount / time.count() / 1e6 << " Mops/s on "
+			<< threads_amount << " threads, hit ratio " << static_cast<double>(total_hits) / amount << '\n';
+	}
+}
+
+
+int bench_main(int argc, char *argv[])
+{
+	string mode = argc > 2 ? argv[2] : "trace";
+	if (mode == "trace")
+	{
+		char k_type, v_type;
+		std::cin >> k_type >> v_type;
+		if (k_type == 'I')
+			bench_trace_v<int>(v_type);
+		if (k_type == 'D')
+			bench_trace_v<double>(v_type);
+		if (k_type == 'S')
+			bench_trace_v<string>(v_type);
+		return 0;
+	}
+	if (mode != "uniform" && mode != "zipf" && mode != "sequential" && mode != "cache")
+	{
+		cerr << "usage: " << argv[0] << " bench [trace | uniform | zipf | sequential | cache] [ops] [keys] [threads]\n";
+		return 1;
+	}
+	size_t amount = argc > 3 ? stoul(argv[3]) : 1000000;
+	size_t keys = argc > 4 ? stoul(argv[4]) : 100000;
+	if (keys == 0)
+	{
+		cerr << "bench: keys must be positive\n";
+		return 1;
+	}
+	if (mode == "cache")
+		bench_cache(amount, keys, argc > 5 ? stoul(argv[5]) : thread::hardware_concurrency());
+	else
+		bench_synthetic(mode, amount, keys);
+	return 0;
+}
+
+
+int test_main()
+{
+	int failed = 0;
+	auto check = [&failed](bool passed, const char* name)
+	{
+		if (!passed)
+		{
+			cout << "FAILED: " << name << '\n';
+			++failed;
+		}
+	};
+	{
+		HashMap<int, int> map;
+		check(map.emplace(1, 10) && map.find(1) == 10, "emplace inserts a new key");
+		check(!map.emplace(1, 20) && map.find(1) == 10, "emplace keeps the value of an existing key");
+		check(!map.try_emplace(1, 30) && map.find(1) == 10, "try_emplace keeps the value of an existing key");
+		check(!map.insert_or_assign(1, 40) && map.find(1) == 40, "insert_or_assign overwrites an existing key");
+		check(map.get_size() == 1 && map.get_amount_unique() == 1, "existing-key writes keep one element");
+	}
+	for (unsigned char precision : { 0, 4, 18, 64, 255 })
+	{
+		HashMap<int, int> map;
+		for (int i = 0; i < 1000; ++i)
+			map.insert(i, i % 100);
+		map.use_approx_unique(precision);
+		size_t estimate = map.get_amount_unique();
+		check(estimate > 50 && estimate < 150, "use_approx_unique clamps the precision");
+	}
+	{
+		const string path = "test_snapshot.hmap";
+		HashMap<int, int> map;
+		for (int i = 0; i < 100; ++i)
+			map.insert(i, i * 2);
+		check(map.save(path), "save writes a snapshot");
+		HashMap<int, int> loaded;
+		check(loaded.load(path) && loaded.get_size() == 100 && loaded.find(42) == 84, "load reads a valid snapshot");
+		fstream file(path, ios::binary | ios::in | ios::out);
+		SnapshotHeader header;
+		file.read(reinterpret_cast<char*>(&header), sizeof(header));
+		header.size = header.block_size;
+		file.seekp(0);
+		file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		file.close();
+		HashMap<int, int> full;
+		check(!full.load(path), "load rejects a snapshot without free slots");
+		header.size = 100;
+		header.hash_id ^= 1;
+		file.open(path, ios::binary | ios::in | ios::out);
+		file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		file.close();
+		HashMap<int, int> foreign;
+		check(!foreign.load(path), "load rejects a snapshot from another hash function");
+		header.hash_id ^= 1;
+		file.open(path, ios::binary | ios::in | ios::out);
+		file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		vector<char> original(header.block_size * header.slot_size);
+		file.seekg(snapshot_offset);
+		file.read(original.data(), original.size());
+		vector<char> slots = original;
+		for (size_t i = 0; i < header.block_size; ++i)
+			slots[i * header.slot_size + 2 * sizeof(int)] = 0;
+		file.seekp(snapshot_offset);
+		file.write(slots.data(), slots.size());
+		file.close();
+		HashMap<int, int> no_free;
+		check(!no_free.load(path), "load rejects slots without a free one");
+		slots = original;
+		size_t free_slot = 0;
+		while (slots[free_slot * header.slot_size + 2 * sizeof(int)] == 0)
+			++free_slot;
+		slots[free_slot * header.slot_size + 2 * sizeof(int)] = 7;
+		file.open(path, ios::binary | ios::in | ios::out);
+		file.seekp(snapshot_offset);
+		file.write(slots.data(), slots.size());
+		file.close();
+		HashMap<int, int> bad_flag;
+		check(!bad_flag.load(path), "load rejects slot flags other than 0 and 1");
+		remove(path.c_str());
+	}
+	cout << (failed == 0 ? "all checks passed" : "checks failed") << '\n';
+	return failed == 0 ? 0 : 1;
 }
 
 
-int main()
+int main(int argc, char *argv[])
 {
+	if (argc > 1 && string(argv[1]) == "bench")
+		return bench_main(argc, argv);
+	if (argc > 1 && string(argv[1]) == "test")
+		return test_main();
 	char k_type, v_type;
 	std::cin >> k_type >> v_type;
 	if (k_type == 'I')